@@ -1,13 +1,43 @@
 #include <Arduino.h>
+
+// Decoder profile: compile in only the decoders an installation needs (selected per
+// environment in platformio.ini). Without a profile IRremote builds all of its decoders.
+#if defined(DECODER_PROFILE_NEC)
+#define DECODE_NEC
+#elif defined(DECODER_PROFILE_TV)
+#define DECODE_NEC
+#define DECODE_SAMSUNG
+#define DECODE_SONY
+#define DECODE_RC5
+#define DECODE_RC6
+#define DECODE_KASEIKYO
+#define DECODE_LG
+#define DECODE_HASH
+#endif
+
 #include <IRremote.hpp>
 #include <WiFi.h>
 #include <WebServer.h>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
 #include <Preferences.h>
+#include <LittleFS.h>
+#include <PubSubClient.h>
+#include <HTTPClient.h>
+#include <time.h>
+#include <esp_heap_caps.h>
+#include <esp_sleep.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include <esp_system.h>
 
 // ESP32 pin configuration
 static const uint8_t IR_RECEIVE_PIN = 14; 
 static const uint8_t LED_PIN = 2;
+static const uint8_t IR_TRANSMIT_PIN = 4;     // IR LED for rule macros
 
 // WiFi Access Point configuration (fallback)
 const char* ap_ssid = "ESP32_IR_Receiver";
@@ -33,18 +63,453 @@ String lastRawData = "N/A";
 unsigned long lastReceiveTime = 0;
 int signalCount = 0;
 
+// Decoded fields of one frame, fixed layout (history ring, history file, RTC snapshot)
+struct HistoryEvent {
+  uint32_t seq;
+  uint32_t time;       // timeline seconds
+  uint64_t rawData;
+  uint16_t address;
+  uint16_t command;
+  uint16_t bits;
+  uint8_t protocol;    // decode_type_t
+  uint8_t flags;
+};
+
 // Structure for saving commands
 struct IRCommand {
+  uint32_t id;
   String protocol;
   String address;
   String command;
   String rawData;
   String timestamp;
+  String label;
+  HistoryEvent frame;  // decoded fields, kept so the command survives a reset
 };
 
 // Vector for saved commands (max 50 commands to avoid filling memory)
 std::vector<IRCommand> savedCommands;
 const int MAX_SAVED_COMMANDS = 50;
+uint32_t nextCommandId = 1;
+
+// Recent events and saved commands in RTC slow memory. RTC_NOINIT_ATTR is left alone by
+// watchdog, panic, brownout and software resets (not power loss); a checksum validates it at boot.
+struct HistoryCommand {
+  uint32_t id;
+  uint32_t timestamp;  // seconds since boot when saved
+  HistoryEvent frame;
+  char label[24];
+};
+
+const uint32_t RTC_HISTORY_MAGIC = 0x49524854;   // "IRHT"
+const uint16_t RTC_HISTORY_VERSION = 2;
+const int RTC_HISTORY_EVENTS = 32;
+
+struct RtcHistory {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;                                 // sizeof(RtcHistory), catches layout changes
+  uint32_t checksum;                             // FNV-1a over the counters up to eventChecksums
+  uint32_t signalCount;
+  uint32_t nextSeq;                              // sequence number of the next event
+  uint32_t flushedSeq;                           // events before this one are on flash
+  uint32_t nextCommandId;
+  uint32_t commandCount;
+  uint32_t commandsChecksum;                     // FNV-1a over the saved commands
+  uint32_t eventChecksums[RTC_HISTORY_EVENTS];   // FNV-1a of each event slot, so a frame seals only its own
+  HistoryEvent events[RTC_HISTORY_EVENTS];       // event seq lives at seq % RTC_HISTORY_EVENTS
+  HistoryCommand commands[MAX_SAVED_COMMANDS];
+};
+
+RTC_NOINIT_ATTR RtcHistory rtcHistory;
+HistoryEvent lastEvent;
+const char* HISTORY_FILE = "/history.bin";
+const char* HISTORY_OLD_FILE = "/history.old";
+const uint32_t HISTORY_FLUSH_BATCH = 16;
+const unsigned long HISTORY_FLUSH_MS = 10UL * 60 * 1000;
+const uint32_t HISTORY_FILE_MAX_EVENTS = 2048;  // then rotated to HISTORY_OLD_FILE
+const int HISTORY_DEFAULT_LIMIT = 20;
+const int HISTORY_MAX_LIMIT = 100;
+esp_reset_reason_t bootResetReason = ESP_RST_UNKNOWN;
+bool historyRestored = false;
+unsigned long lastHistoryFlush = 0;
+uint32_t historyDropped = 0;
+
+// Secondary indexes over savedCommands: key -> ascending list of command ids
+std::map<String, std::vector<uint32_t>> protocolIndex;
+std::map<String, std::vector<uint32_t>> addressIndex;
+const int COMMANDS_DEFAULT_LIMIT = 20;
+const int COMMANDS_MAX_LIMIT = 100;
+
+// Imported code library: fixed-size records appended to a LittleFS file
+struct LibraryRecord {
+  char protocol[16];
+  uint16_t address;
+  uint16_t command;
+  char label[28];
+};
+
+// In-RAM library index: 8 bytes per record, sorted by key hash. Its capacity is reserved in
+// one allocation (at boot and when an import starts) and never grown by push_back.
+struct LibraryKey {
+  uint32_t hash;
+  uint32_t record;
+};
+
+const char* LIBRARY_FILE = "/library.bin";
+const uint32_t LIBRARY_MAX_RECORDS = 8192;
+const uint32_t LIBRARY_IMPORT_RESERVE = 2048;        // index slots added per import (16 KB)
+const size_t LIBRARY_HEAP_HEADROOM = 32 * 1024;      // heap left free after sizing the index
+const int IMPORT_BATCH_SIZE = 32;
+const int IMPORT_LINE_LENGTH = 256;
+std::vector<LibraryKey> libraryIndex;
+uint32_t libraryCount = 0;
+uint32_t libraryUnindexed = 0;                       // records on flash the index had no room for
+SemaphoreHandle_t libraryMutex = NULL;               // index is written on core 1, read by the MQTT task
+
+enum ImportFormat { IMPORT_CSV, IMPORT_JSONL, IMPORT_FLIPPER, IMPORT_LIRC };
+
+// State of the streaming import: one line buffer and one batch, independent of upload size
+struct ImportState {
+  bool active;
+  bool detected;
+  ImportFormat format;
+  char line[IMPORT_LINE_LENGTH];
+  int lineLength;
+  bool lineOverflow;
+  LibraryRecord batch[IMPORT_BATCH_SIZE];
+  int batchCount;
+  unsigned long startTime;
+  size_t bytes;
+  uint32_t parsed;
+  uint32_t imported;
+  uint32_t duplicates;
+  uint32_t invalid;
+  uint32_t unsupported;
+  uint32_t rejected;
+  // Flipper .ir block being assembled
+  char flipperName[28];
+  char flipperProtocol[16];
+  uint32_t flipperAddress;
+  uint32_t flipperCommand;
+  bool flipperParsed;
+  bool flipperHasAddress;
+  bool flipperHasCommand;
+  // LIRC remote being parsed
+  bool lircInCodes;
+  bool lircInRaw;
+  char lircFlags[48];
+  uint16_t lircHeaderMark;
+  uint16_t lircHeaderSpace;
+  uint8_t lircBits;
+  uint8_t lircPreDataBits;
+  uint32_t lircPreData;
+};
+ImportState importState;
+
+// Running mean/variance as integer sum and sum of squares: the capture path only adds, and
+// floating point (software double on the ESP32) is used when /stats is read. 64 bits hold
+// 10^11 samples of 1 ms (in microseconds) before sumSquares wraps.
+struct RunningStat {
+  uint32_t count;
+  int64_t sum;
+  uint64_t sumSquares;
+};
+
+// Signal quality counters; constant size, updated on every frame
+const int JITTER_BUCKETS = 8;                // |deviation| buckets, the last one is open-ended
+const int JITTER_BUCKET_US = 50;
+const unsigned long INTER_FRAME_GAP_MAX_MS = 500;   // longer gaps start a new key press
+struct SignalStats {
+  uint32_t frames;
+  uint32_t repeats;
+  uint32_t overflows;
+  uint32_t parityErrors;
+  RunningStat markJitter;                    // measured - nominal mark, microseconds
+  RunningStat spaceJitter;                   // measured - nominal space, microseconds
+  RunningStat frameGap;                      // milliseconds between frames of one key press
+  uint32_t jitterHistogram[JITTER_BUCKETS];
+  unsigned long lastSeen;
+};
+
+struct CodeStats {
+  decode_type_t protocol;
+  uint16_t address;
+  uint16_t command;
+  SignalStats stats;
+};
+
+const int MAX_CODE_STATS = 32;               // least recently seen code is evicted when full
+CodeStats codeStats[MAX_CODE_STATS];
+int codeStatsCount = 0;
+SignalStats deviceStats;
+uint32_t decodeFailures = 0;               // frames no decoder accepted
+uint32_t hashFrames = 0;                   // frames only the hash decoder accepted (protocol UNKNOWN)
+
+// Uptime without the 49-day millis() wrap, plus the offset to wall-clock time once NTP has synced
+uint64_t uptimeMs = 0;
+unsigned long clockLastMillis = 0;
+uint32_t timelineOffset = 0;                 // seconds added to uptime: device time before NTP, epoch after
+bool wallClockValid = false;
+const time_t WALL_CLOCK_MIN = 1600000000;    // time() below this: NTP has not synced
+const char* NTP_SERVER = "pool.ntp.org";
+
+// Tiered press counters: every event lands in a minute, an hour and a day bucket
+enum TimeSeriesTier { TIER_MINUTE, TIER_HOUR, TIER_DAY, TIER_COUNT };
+const int TS_MINUTES = 60;                   // last hour
+const int TS_HOURS = 168;                    // last week
+const int TS_DAYS = 90;                      // last quarter
+const uint32_t tierSeconds[TIER_COUNT] = { 60, 3600, 86400 };
+const int tierSize[TIER_COUNT] = { TS_MINUTES, TS_HOURS, TS_DAYS };
+const uint8_t SERIES_UNUSED = 0;
+const uint8_t SERIES_CODE = 1;
+const uint8_t SERIES_ALL = 2;
+struct TimeSeries {
+  uint8_t kind;
+  decode_type_t protocol;
+  uint16_t address;
+  uint16_t command;
+  uint32_t lastSeen;                         // timeline seconds
+  uint16_t minutes[TS_MINUTES];
+  uint16_t hours[TS_HOURS];
+  uint16_t days[TS_DAYS];
+};
+
+const int MAX_TIME_SERIES = 17;              // slot 0 counts all codes
+TimeSeries timeSeries[MAX_TIME_SERIES];
+uint32_t timeSeriesHead[TIER_COUNT];         // bucket index of the newest bucket per tier, shared by all series
+const char* TIMESERIES_FILE = "/timeseries.bin";
+const char* TIMESERIES_LIVE_FILE = "/timeseries_live.bin";   // device-time counters while NTP is pending
+const uint32_t TIMESERIES_MAGIC = 0x54534552;
+const uint16_t TIMESERIES_VERSION = 1;
+const unsigned long TIMESERIES_PERSIST_MS = 15UL * 60 * 1000;
+unsigned long lastTimeSeriesPersist = 0;
+bool timeSeriesRestorePending = false;       // saved data has wall-clock buckets, wait for NTP
+
+// Device-side rules: "code [hold=ms] [repeat=n] -> action", stored as text in Preferences
+enum RuleAction { ACTION_GPIO, ACTION_IR, ACTION_HTTP, ACTION_MQTT };
+
+struct IrStep {
+  decode_type_t protocol;
+  uint16_t address;
+  uint16_t command;
+};
+
+const int MAX_RULES = 64;
+const int MAX_MACRO_STEPS = 8;
+const int RULE_TABLE_SIZE = 128;             // power of two, at least twice MAX_RULES
+const size_t MAX_RULES_TEXT = 3900;          // NVS string limit
+const unsigned long NEW_PRESS_GAP_MS = 300;
+
+struct Rule {
+  uint16_t holdMs;
+  uint8_t repeatCount;
+  RuleAction action;
+  uint8_t pin;
+  int16_t next;                              // next rule for the same code, -1 at the end
+  bool fired;                                // already fired during the current key press
+  String text;                               // URL, or "topic payload"
+  std::vector<IrStep> steps;
+};
+
+// Open-addressing dispatch table, one slot per distinct code
+struct RuleSlot {
+  bool used;
+  decode_type_t protocol;
+  uint16_t address;
+  uint16_t command;
+  int16_t firstRule;
+  unsigned long pressStart;
+  unsigned long lastFrame;
+  uint16_t pressFrames;
+};
+
+// Self-contained job for the rule worker, so recompiling rules never invalidates queued work
+struct RuleJob {
+  RuleAction action;
+  uint8_t stepCount;
+  IrStep steps[MAX_MACRO_STEPS];
+  char text[160];
+};
+
+struct MqttMessage {
+  char topic[64];
+  char payload[96];
+};
+
+std::vector<Rule> rules;
+RuleSlot ruleTable[RULE_TABLE_SIZE];
+String rulesText = "";
+QueueHandle_t ruleQueue = NULL;
+QueueHandle_t mqttMessageQueue = NULL;
+const int RULE_QUEUE_LENGTH = 8;
+uint32_t rulesFired = 0;
+std::atomic<uint32_t> ruleJobsDropped(0);  // counted by the loop and the rule worker
+RunningStat ruleEvalMicros;
+uint32_t ruleEvalMaxMicros = 0;
+
+// Decoders tried by decodeWithProfile(), with per-protocol cost accounting
+struct DecoderEntry {
+  const char* name;
+  bool (IRrecv::*decode)();
+  bool pinned;                               // catch-all decoders always run last
+  uint16_t headerMarkMicros;                 // shortest leader mark among its protocols
+  uint32_t attempts;
+  uint32_t hits;
+  uint32_t recentHits;                       // priority weight, halved at every reorder
+  uint64_t micros;
+};
+
+DecoderEntry decoders[] = {
+#if defined(DECODE_NEC) || defined(DECODE_ONKYO)
+  { "NEC", &IRrecv::decodeNEC, false, 9000, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_PANASONIC) || defined(DECODE_KASEIKYO)
+  { "Kaseikyo", &IRrecv::decodeKaseikyo, false, 3456, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_DENON) || defined(DECODE_SHARP)
+  { "Denon", &IRrecv::decodeDenon, false, 260, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_SONY)
+  { "Sony", &IRrecv::decodeSony, false, 2400, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_RC5)
+  { "RC5", &IRrecv::decodeRC5, false, 889, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_RC6)
+  { "RC6", &IRrecv::decodeRC6, false, 2666, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_LG)
+  { "LG", &IRrecv::decodeLG, false, 3200, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_JVC)
+  { "JVC", &IRrecv::decodeJVC, false, 8400, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_SAMSUNG)
+  { "Samsung", &IRrecv::decodeSamsung, false, 4500, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_WHYNTER)
+  { "Whynter", &IRrecv::decodeWhynter, false, 2850, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_LEGO_PF)
+  { "Lego", &IRrecv::decodeLegoPowerFunctions, false, 158, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_BOSEWAVE)
+  { "BoseWave", &IRrecv::decodeBoseWave, false, 1060, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_MAGIQUEST)
+  { "MagiQuest", &IRrecv::decodeMagiQuest, false, 287, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_FAST)
+  { "FAST", &IRrecv::decodeFAST, false, 2100, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_DISTANCE_WIDTH)
+  { "DistanceWidth", &IRrecv::decodeDistanceWidth, true, 0, 0, 0, 0, 0 },
+#endif
+#if defined(DECODE_HASH)
+  { "Hash", &IRrecv::decodeHash, true, 0, 0, 0, 0, 0 },
+#endif
+};
+
+const int DECODER_COUNT = sizeof(decoders) / sizeof(decoders[0]);
+const uint32_t DECODER_REORDER_INTERVAL = 32;    // successful decodes between priority updates
+uint8_t decoderOrder[DECODER_COUNT];
+uint32_t decoderMask = 0xFFFFFFFF;                // bit i enables decoders[i]; saved by name
+uint32_t decodesSinceReorder = 0;
+RunningStat decodeMicros;
+
+// Heap health, sampled periodically so field numbers can be compared over long uptimes
+struct HeapSample {
+  uint32_t uptimeSeconds;
+  uint32_t freeBytes;
+  uint32_t largestBlock;
+  uint32_t allocatedBlocks;
+};
+
+const int HEAP_SAMPLES = 96;                 // 24 hours at one sample per 15 minutes
+const unsigned long HEAP_SAMPLE_MS = 15UL * 60 * 1000;
+const uint32_t HEAP_LARGEST_BLOCK_WARN = 16384;
+HeapSample heapSamples[HEAP_SAMPLES];
+int heapSampleHead = 0;
+int heapSampleCount = 0;
+unsigned long lastHeapSample = 0;
+uint32_t lowestLargestBlock = UINT32_MAX;
+volatile uint32_t failedAllocs = 0;
+volatile uint32_t largestFailedAlloc = 0;
+
+// Main loop scheduling: loop() blocks until the IR edge interrupt fires or its next deadline.
+// Build with -D IDLE_LIGHT_SLEEP for automatic light sleep: the idle task sleeps whenever all
+// tasks are blocked, WiFi stays associated in modem sleep and the receiver pin wakes the chip.
+const uint32_t FRAME_POLL_MS = 5;            // while a frame is being captured
+const uint32_t FRAME_TIMEOUT_MS = 200;       // an edge with no frame by then is counted as noise
+const uint32_t HTTP_ACTIVE_POLL_MS = 10;
+const uint32_t HTTP_IDLE_POLL_MS = 100;      // WebServer has no readiness event to block on
+const uint32_t HTTP_ACTIVE_WINDOW_MS = 2000; // fast polling for this long after a client was seen
+const uint32_t LED_HOLD_MS = 200;
+const uint32_t LIGHT_SLEEP_MIN_HEADER_US = 4000;  // a ~1 ms wakeup stays within IRremote's 25% mark tolerance
+TaskHandle_t loopTaskHandle = NULL;
+volatile bool irEdgePending = false;
+volatile unsigned long irEdgeMicros = 0;
+unsigned long lastHttpActivity = 0;
+bool ledOn = false;
+unsigned long ledOffAt = 0;
+uint32_t loopWakeups = 0;
+uint32_t irWakeups = 0;
+uint32_t timerWakeups = 0;
+esp_pm_lock_handle_t lightSleepLock = NULL;       // held while a frame is captured or a short-leader decoder is on
+volatile bool frameHoldsLightSleepLock = false;
+bool lightSleepBlocked = false;
+uint64_t blockedMicros = 0;
+uint32_t edgesWithoutFrame = 0;
+RunningStat wakeToDecodeMicros;
+uint32_t maxWakeToDecodeMicros = 0;
+RunningStat leaderLossMicros;                    // nominal minus captured leader mark of decoded frames
+uint32_t maxLeaderLossMicros = 0;
+
+// Fixed-size IR event handed from the capture path to the MQTT publisher task
+struct IREvent {
+  uint32_t sequence;
+  uint32_t timestampMs;
+  uint16_t address;
+  uint16_t command;
+  char protocol[16];
+  char label[24];
+};
+
+// MQTT publisher configuration (stored in Preferences, namespace "mqtt")
+String mqtt_host = "";
+uint16_t mqtt_port = 1883;
+String mqtt_user = "";
+String mqtt_password = "";
+String mqtt_topic = "esp32ir";
+bool mqttConfigured = false;
+volatile bool mqttConfigChanged = false;
+SemaphoreHandle_t mqttConfigMutex = NULL;   // the strings above are rewritten on core 1, read on core 0
+
+// MQTT publisher state
+WiFiClient mqttNetClient;
+PubSubClient mqttClient(mqttNetClient);
+QueueHandle_t mqttQueue = NULL;
+const int MQTT_QUEUE_LENGTH = 32;         // capture path -> publisher task
+const int MQTT_PENDING_LENGTH = 64;       // RAM buffer while the broker is unreachable
+const int MQTT_MAX_BATCH = 16;            // events per publish
+const unsigned long MQTT_BATCH_LINGER_MS = 50;
+const unsigned long MQTT_RECONNECT_MS = 5000;
+const size_t MQTT_SPOOL_MAX_BYTES = 64 * 1024;
+const char* MQTT_SPOOL_FILE = "/mqtt_spool.bin";
+IREvent mqttPending[MQTT_PENDING_LENGTH];
+int mqttPendingHead = 0;
+int mqttPendingCount = 0;
+size_t mqttSpoolReadPos = 0;
+size_t mqttSpoolSize = 0;
+volatile uint32_t mqttPublished = 0;
+volatile uint32_t mqttBatches = 0;
+std::atomic<uint32_t> mqttDropped(0);      // counted by the capture path and the publisher
+volatile uint32_t mqttSpooled = 0;
+volatile bool mqttConnected = false;
+unsigned long mqttLastAttempt = 0;
+bool mqttAttempted = false;
+bool flashMounted = false;
 
 // HTML page with AJAX
 const char htmlPage[] PROGMEM = R"rawliteral(
@@ -256,6 +721,7 @@ const char htmlPage[] PROGMEM = R"rawliteral(
         <div class="tabs">
             <button class="tab-button active" onclick="switchTab('monitor')">📊 IR Monitoring</button>
             <button class="tab-button" onclick="switchTab('wifi')">📡 WiFi Configuration</button>
+            <button class="tab-button" onclick="switchTab('mqtt')">📨 MQTT</button>
         </div>
         
         <!-- IR Monitoring Tab -->
@@ -357,6 +823,47 @@ const char htmlPage[] PROGMEM = R"rawliteral(
             </div>
         </div>
 
+        <!-- MQTT Tab -->
+        <div id="mqtt-tab" class="tab-content">
+            <div id="mqttStatus" class="wifi-status wifi-disconnected">
+                MQTT: not configured
+            </div>
+            
+            <h3 style="margin-bottom: 15px; color: #1e293b;">Publish IR events to an MQTT broker</h3>
+            <p style="margin-bottom: 20px; color: #64748b;">Events are published to <strong>&lt;topic&gt;/events</strong>, device status to <strong>&lt;topic&gt;/status</strong>. Leave the broker empty to disable publishing.</p>
+            
+            <div class="form-group">
+                <label class="form-label">Broker host</label>
+                <input type="text" id="mqttHost" class="form-input" placeholder="192.168.1.10">
+            </div>
+            
+            <div class="form-group">
+                <label class="form-label">Port</label>
+                <input type="number" id="mqttPort" class="form-input" value="1883">
+            </div>
+            
+            <div class="form-group">
+                <label class="form-label">Username (optional)</label>
+                <input type="text" id="mqttUser" class="form-input">
+            </div>
+            
+            <div class="form-group">
+                <label class="form-label">Password (optional)</label>
+                <input type="password" id="mqttPassword" class="form-input">
+            </div>
+            
+            <div class="form-group">
+                <label class="form-label">Base topic</label>
+                <input type="text" id="mqttTopic" class="form-input" value="esp32ir">
+            </div>
+            
+            <button onclick="saveMqttConfig()" class="btn btn-primary" style="width: 100%;">
+                💾 Save MQTT configuration
+            </button>
+            
+            <div id="mqttMessage" style="margin-top: 15px; padding: 10px; border-radius: 8px; text-align: center; display: none;"></div>
+        </div>
+
         <div class="footer">
             Made with ❤️ using ESP32 WROOM
         </div>
@@ -484,6 +991,9 @@ const char htmlPage[] PROGMEM = R"rawliteral(
             if (tabName === 'wifi') {
                 updateWiFiStatus();
             }
+            if (tabName === 'mqtt') {
+                updateMqttStatus();
+            }
         }
         
         // Functions for WiFi
@@ -555,6 +1065,53 @@ const char htmlPage[] PROGMEM = R"rawliteral(
             }
         }
         
+        // Functions for MQTT
+        function updateMqttStatus() {
+            fetch('/mqtt_status')
+                .then(response => response.json())
+                .then(data => {
+                    const statusDiv = document.getElementById('mqttStatus');
+                    if (!data.configured) {
+                        statusDiv.className = 'wifi-status wifi-disconnected';
+                        statusDiv.textContent = 'MQTT: not configured';
+                    } else {
+                        statusDiv.className = 'wifi-status ' + (data.connected ? 'wifi-connected' : 'wifi-disconnected');
+                        statusDiv.textContent = (data.connected ? '✅ Connected to ' : '❌ Disconnected from ') + data.host + ':' + data.port +
+                            ' | published: ' + data.published + ' | queued: ' + (data.pending + data.spooled) + ' | dropped: ' + data.dropped;
+                    }
+                    document.getElementById('mqttHost').value = data.host;
+                    document.getElementById('mqttPort').value = data.port;
+                    document.getElementById('mqttUser').value = data.user;
+                    document.getElementById('mqttTopic').value = data.topic;
+                })
+                .catch(error => console.error('Error:', error));
+        }
+        
+        function saveMqttConfig() {
+            const fields = ['host', 'port', 'user', 'password', 'topic'];
+            const body = fields.map(f => {
+                const id = 'mqtt' + f.charAt(0).toUpperCase() + f.slice(1);
+                return f + '=' + encodeURIComponent(document.getElementById(id).value);
+            }).join('&');
+            
+            fetch('/mqtt_config', {
+                method: 'POST',
+                headers: {'Content-Type': 'application/x-www-form-urlencoded'},
+                body: body
+            })
+            .then(response => response.json())
+            .then(data => {
+                const msg = document.getElementById('mqttMessage');
+                msg.textContent = data.message;
+                msg.style.display = 'block';
+                msg.style.background = data.success ? '#d1fae5' : '#fee2e2';
+                msg.style.color = data.success ? '#065f46' : '#991b1b';
+                setTimeout(() => { msg.style.display = 'none'; }, 5000);
+                setTimeout(() => updateMqttStatus(), 1000);
+            })
+            .catch(error => console.error('Error:', error));
+        }
+        
         function showWiFiMessage(text, type) {
             const msg = document.getElementById('wifiMessage');
             msg.textContent = text;
@@ -580,34 +1137,209 @@ const char htmlPage[] PROGMEM = R"rawliteral(
 </html>
 )rawliteral";
 
+// Escape a value for use inside a JSON string
+String jsonEscape(const String& value) {
+  String escaped = value;
+  escaped.replace("\\", "\\\\");
+  escaped.replace("\"", "\\\"");
+  escaped.replace("\n", "\\n");
+  return escaped;
+}
+
+// Normalize a numeric query argument ("4", "0x04", "0x4") to the stored "0x4" form
+String normalizeHexArg(const String& value) {
+  if (value.length() == 0) {
+    return "";
+  }
+  return "0x" + String(strtoul(value.c_str(), NULL, 0), HEX);
+}
+
+// Position of a command in savedCommands (sorted by id), or -1
+int findCommandPosition(uint32_t id) {
+  std::vector<IRCommand>::iterator it = std::lower_bound(savedCommands.begin(), savedCommands.end(), id,
+    [](const IRCommand& cmd, uint32_t key) { return cmd.id < key; });
+  if (it == savedCommands.end() || it->id != id) {
+    return -1;
+  }
+  return it - savedCommands.begin();
+}
+
+void removeFromIndex(std::map<String, std::vector<uint32_t>>& index, const String& key, uint32_t id) {
+  std::map<String, std::vector<uint32_t>>::iterator entry = index.find(key);
+  if (entry == index.end()) {
+    return;
+  }
+  std::vector<uint32_t>& ids = entry->second;
+  ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+  if (ids.empty()) {
+    index.erase(entry);
+  }
+}
+
+uint32_t fnv1a(const void* data, size_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t rtcHistoryChecksum() {
+  return fnv1a(&rtcHistory.signalCount, offsetof(RtcHistory, eventChecksums) - offsetof(RtcHistory, signalCount));
+}
+
+uint32_t rtcCommandsChecksum() {
+  return fnv1a(rtcHistory.commands, min(rtcHistory.commandCount, (uint32_t)MAX_SAVED_COMMANDS) * sizeof(HistoryCommand));
+}
+
+uint32_t rtcEventChecksum(uint32_t seq) {
+  return fnv1a(&rtcHistory.events[seq % RTC_HISTORY_EVENTS], sizeof(HistoryEvent));
+}
+
+// Called after every change to the rtcHistory counters
+void sealRtcHistory() {
+  rtcHistory.checksum = rtcHistoryChecksum();
+}
+
+// Mirror savedCommands into RTC memory (labels are cut to 23 characters there)
+void snapshotSavedCommands() {
+  rtcHistory.commandCount = savedCommands.size();
+  rtcHistory.nextCommandId = nextCommandId;
+  for (size_t i = 0; i < savedCommands.size(); i++) {
+    HistoryCommand& slot = rtcHistory.commands[i];
+    slot.id = savedCommands[i].id;
+    slot.timestamp = savedCommands[i].timestamp.toInt();
+    slot.frame = savedCommands[i].frame;
+    strlcpy(slot.label, savedCommands[i].label.c_str(), sizeof(slot.label));
+  }
+  rtcHistory.commandsChecksum = rtcCommandsChecksum();
+  sealRtcHistory();
+}
+
+// Text shown for a frame in the web interface and the download
+void formatRawData(char* buffer, size_t size, const HistoryEvent& event) {
+  snprintf(buffer, size, "Protocol: %s\nAddress: 0x%x\nCommand: 0x%x\nFlags: 0x%x\nRaw Code: 0x%llx\nBits: %u",
+           getProtocolString((decode_type_t)event.protocol), event.address, event.command, event.flags,
+           (unsigned long long)event.rawData, (unsigned)event.bits);
+}
+
+// Set the last-signal fields from a frame (formatted in place so the reserved String buffers are reused)
+void setLastSignal(const HistoryEvent& event) {
+  char text[192];
+  lastProtocol = getProtocolString((decode_type_t)event.protocol);
+  snprintf(text, sizeof(text), "0x%x", event.address);
+  lastAddress = text;
+  snprintf(text, sizeof(text), "0x%x", event.command);
+  lastCommand = text;
+  formatRawData(text, sizeof(text), event);
+  lastRawData = text;
+}
+
+// Append a command to the store and both indexes, returns its id
+uint32_t addSavedCommand(IRCommand cmd) {
+  cmd.id = nextCommandId++;
+  savedCommands.push_back(cmd);
+  protocolIndex[cmd.protocol].push_back(cmd.id);
+  addressIndex[cmd.address].push_back(cmd.id);
+  snapshotSavedCommands();
+  return cmd.id;
+}
+
+bool deleteSavedCommand(uint32_t id) {
+  int pos = findCommandPosition(id);
+  if (pos < 0) {
+    return false;
+  }
+  removeFromIndex(protocolIndex, savedCommands[pos].protocol, id);
+  removeFromIndex(addressIndex, savedCommands[pos].address, id);
+  savedCommands.erase(savedCommands.begin() + pos);
+  snapshotSavedCommands();
+  return true;
+}
+
+void clearSavedCommands() {
+  savedCommands.clear();
+  protocolIndex.clear();
+  addressIndex.clear();
+  snapshotSavedCommands();
+}
+
+void appendCommandJson(String& json, const IRCommand& cmd) {
+  json += "{\"id\":";
+  json += cmd.id;
+  json += ",\"protocol\":\"";
+  json += cmd.protocol;
+  json += "\",\"address\":\"";
+  json += cmd.address;
+  json += "\",\"command\":\"";
+  json += cmd.command;
+  json += "\",\"label\":\"";
+  json += jsonEscape(cmd.label);
+  json += "\",\"timestamp\":\"";
+  json += cmd.timestamp;
+  json += "\",\"rawData\":\"";
+  json += jsonEscape(cmd.rawData);
+  json += "\"}";
+}
+
+String commandToJson(const IRCommand& cmd) {
+  String json;
+  json.reserve(256);
+  appendCommandJson(json, cmd);
+  return json;
+}
+
 // Handler for main page
 void handleRoot() {
   server.send(200, "text/html", htmlPage);
 }
 
 // Handler for JSON data (AJAX endpoint)
+// Polled every 500ms, so it appends into one reserved buffer instead of creating temporaries
 void handleData() {
-  // Escape newlines for valid JSON
-  String escapedRawData = lastRawData;
-  escapedRawData.replace("\n", "\\n");
-  escapedRawData.replace("\"", "\\\"");
-  
-  String json = "{";
-  json += "\"protocol\":\"" + lastProtocol + "\",";
-  json += "\"address\":\"" + lastAddress + "\",";
-  json += "\"command\":\"" + lastCommand + "\",";
-  json += "\"rawData\":\"" + escapedRawData + "\",";
-  json += "\"count\":" + String(signalCount) + ",";
+  String json;
+  json.reserve(384);
+  json += "{\"protocol\":\"";
+  json += lastProtocol;
+  json += "\",\"address\":\"";
+  json += lastAddress;
+  json += "\",\"command\":\"";
+  json += lastCommand;
+  json += "\",\"rawData\":\"";
+  for (unsigned int i = 0; i < lastRawData.length(); i++) {
+    char c = lastRawData[i];
+    if (c == '\n') {
+      json += "\\n";
+    } else {
+      if (c == '"' || c == '\\') {
+        json += '\\';
+      }
+      json += c;
+    }
+  }
+  json += "\",\"count\":";
+  json += signalCount;
   
   if (lastReceiveTime > 0) {
-    unsigned long timeAgo = (millis() - lastReceiveTime) / 1000;
-    json += "\"lastTime\":\"" + String(timeAgo) + " seconds ago\"";
+    json += ",\"lastTime\":\"";
+    json += (millis() - lastReceiveTime) / 1000;
+    json += " seconds ago\"}";
+  } else if (historyRestored && rtcHistory.nextSeq > 0) {
+    // Restored from RTC memory: no millis() on this boot's clock, but a frame stamped with
+    // Unix time can be aged once NTP has synced again
+    time_t now = time(NULL);
+    if (wallClockValid && lastEvent.time >= WALL_CLOCK_MIN && now >= (time_t)lastEvent.time) {
+      json += ",\"lastTime\":\"";
+      json += (unsigned long)(now - lastEvent.time);
+      json += " seconds ago\"}";
+    } else {
+      json += ",\"lastTime\":\"Before the last reset\"}";
+    }
   } else {
-    json += "\"lastTime\":\"No signal yet\"";
+    json += ",\"lastTime\":\"No signal yet\"}";
   }
   
-  json += "}";
-  
   server.send(200, "application/json", json);
 }
 
@@ -629,10 +1361,12 @@ void handleSave() {
   cmd.command = lastCommand;
   cmd.rawData = lastRawData;
   cmd.timestamp = String(millis() / 1000) + "s";
+  cmd.label = server.arg("label");
+  cmd.frame = lastEvent;
   
-  savedCommands.push_back(cmd);
+  uint32_t id = addSavedCommand(cmd);
   
-  String response = "{\"success\":true,\"message\":\"Comandă salvată! Total: " + String(savedCommands.size()) + "\"}";
+  String response = "{\"success\":true,\"id\":" + String(id) + ",\"message\":\"Comandă salvată! Total: " + String(savedCommands.size()) + "\"}";
   server.send(200, "application/json", response);
 }
 
@@ -643,34 +1377,45 @@ void handleDownload() {
     return;
   }
   
-  String content = "========================================\n";
+  // Sent in chunks, one command at a time, so the file never has to fit in one heap block
+  server.sendHeader("Content-Disposition", "attachment; filename=ir_commands.txt");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain", "");
+  
+  String content;
+  content.reserve(512);
+  content = "========================================\n";
   content += "ESP32 IR RECEIVER - SAVED COMMANDS\n";
   content += "========================================\n";
   content += "Total commands: " + String(savedCommands.size()) + "\n";
   content += "Export date: " + String(millis() / 1000) + " seconds since boot\n";
   content += "========================================\n\n";
+  server.sendContent(content);
   
   for (size_t i = 0; i < savedCommands.size(); i++) {
-    content += "--- Command #" + String(i + 1) + " ---\n";
+    content = "--- Command #" + String(savedCommands[i].id) + " ---\n";
     content += "Timestamp: " + savedCommands[i].timestamp + "\n";
     content += "Protocol: " + savedCommands[i].protocol + "\n";
     content += "Address: " + savedCommands[i].address + "\n";
     content += "Command: " + savedCommands[i].command + "\n";
+    if (savedCommands[i].label.length() > 0) {
+      content += "Label: " + savedCommands[i].label + "\n";
+    }
     content += "Details:\n" + savedCommands[i].rawData + "\n";
     content += "\n";
+    server.sendContent(content);
   }
   
-  content += "========================================\n";
+  content = "========================================\n";
   content += "Generated by ESP32 WROOM with IR Receiver KY-022\n";
   content += "========================================\n";
-  
-  server.sendHeader("Content-Disposition", "attachment; filename=ir_commands.txt");
-  server.send(200, "text/plain", content);
+  server.sendContent(content);
+  server.sendContent("");
 }
 
 // Handler for deleting commands
 void handleClear() {
-  savedCommands.clear();
+  clearSavedCommands();
   server.send(200, "application/json", "{\"success\":true,\"message\":\"All commands deleted!\"}");
 }
 
@@ -680,129 +1425,2765 @@ void handleCount() {
   server.send(200, "application/json", json);
 }
 
-// Functions for managing WiFi config in Preferences
-void saveWiFiCredentials(String ssid, String password) {
-  preferences.begin("wifi", false);
-  preferences.putString("ssid", ssid);
-  preferences.putString("password", password);
-  preferences.putBool("configured", true);
-  preferences.end();
-  Serial.println("WiFi credentials saved to EEPROM");
-}
-
-void loadWiFiCredentials() {
-  preferences.begin("wifi", true);
-  wifiConfigured = preferences.getBool("configured", false);
-  if (wifiConfigured) {
-    wifi_ssid = preferences.getString("ssid", "");
-    wifi_password = preferences.getString("password", "");
-    Serial.println("WiFi credentials loaded from EEPROM");
-    Serial.println("SSID: " + wifi_ssid);
+// i-th command of an index candidate list, or of the whole store when there is none
+const IRCommand* candidateCommand(const std::vector<uint32_t>* candidates, size_t i) {
+  if (candidates == NULL) {
+    return &savedCommands[i];
   }
-  preferences.end();
-}
-
-void clearWiFiCredentials() {
-  preferences.begin("wifi", false);
-  preferences.clear();
-  preferences.end();
-  wifiConfigured = false;
-  wifiConnected = false;
-  wifi_ssid = "";
-  wifi_password = "";
-  Serial.println("WiFi credentials erased from EEPROM");
+  int pos = findCommandPosition((*candidates)[i]);
+  return pos >= 0 ? &savedCommands[pos] : NULL;
 }
 
-// Handler for WiFi status
-void handleWiFiStatus() {
-  String json = "{";
-  json += "\"connected\":" + String(wifiConnected ? "true" : "false") + ",";
-  json += "\"ssid\":\"" + (wifiConnected ? WiFi.SSID() : String(ap_ssid)) + "\",";
-  json += "\"ip\":\"" + (wifiConnected ? WiFi.localIP().toString() : WiFi.softAPIP().toString()) + "\",";
-  json += "\"saved_ssid\":\"" + wifi_ssid + "\"";
-  json += "}";
-  server.send(200, "application/json", json);
+bool commandMatches(const IRCommand& cmd, const String& protocol, const String& address, const String& command) {
+  return (protocol.length() == 0 || cmd.protocol == protocol) &&
+         (address.length() == 0 || cmd.address == address) &&
+         (command.length() == 0 || cmd.command == command);
 }
 
-// Handler for saving WiFi configuration
-void handleWiFiConfig() {
-  if (server.method() != HTTP_POST) {
-    server.send(405, "text/plain", "Method Not Allowed");
+// Handler for paginated, filtered listing of saved commands (JSON)
+void handleCommands() {
+  long offset = server.hasArg("offset") ? server.arg("offset").toInt() : 0;
+  long limit = server.hasArg("limit") ? server.arg("limit").toInt() : COMMANDS_DEFAULT_LIMIT;
+  if (offset < 0) {
+    offset = 0;
+  }
+  if (limit <= 0) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"limit must be at least 1!\"}");
     return;
   }
+  if (limit > COMMANDS_MAX_LIMIT) {
+    limit = COMMANDS_MAX_LIMIT;
+  }
   
-  String ssid = server.arg("ssid");
-  String password = server.arg("password");
+  String protocol = server.arg("protocol");
+  String address = normalizeHexArg(server.arg("address"));
+  String command = normalizeHexArg(server.arg("command"));
   
-  if (ssid.length() == 0) {
-    server.send(200, "application/json", "{\"success\":false,\"message\":\"Invalid SSID!\"}");
-    return;
+  // Pick the narrowest index for the filters given; without filters walk the store
+  static const std::vector<uint32_t> noIds;
+  const std::vector<uint32_t>* candidates = NULL;
+  if (protocol.length() > 0) {
+    std::map<String, std::vector<uint32_t>>::iterator entry = protocolIndex.find(protocol);
+    candidates = entry != protocolIndex.end() ? &entry->second : &noIds;
+  }
+  if (address.length() > 0) {
+    std::map<String, std::vector<uint32_t>>::iterator entry = addressIndex.find(address);
+    const std::vector<uint32_t>* byAddress = entry != addressIndex.end() ? &entry->second : &noIds;
+    if (candidates == NULL || byAddress->size() < candidates->size()) {
+      candidates = byAddress;
+    }
   }
   
-  // Save credentials
-  saveWiFiCredentials(ssid, password);
-  
-  server.send(200, "application/json", "{\"success\":true,\"message\":\"Configuration saved! ESP32 will restart...\"}");
+  // Count the matches for "total" first, then stream the page one command at a time
+  size_t candidateCount = candidates != NULL ? candidates->size() : savedCommands.size();
+  long total = 0;
+  for (size_t i = 0; i < candidateCount; i++) {
+    const IRCommand* cmd = candidateCommand(candidates, i);
+    if (cmd != NULL && commandMatches(*cmd, protocol, address, command)) {
+      total++;
+    }
+  }
   
-  // Restart ESP32 after 3 seconds
-  delay(3000);
-  ESP.restart();
-}
-
-// Handler for clearing WiFi configuration
-void handleWiFiClear() {
-  clearWiFiCredentials();
-  server.send(200, "application/json", "{\"success\":true,\"message\":\"WiFi configuration cleared!\"}");
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/json", "");
+  String json;
+  json.reserve(512);
+  json = "{\"total\":";
+  json += total;
+  json += ",\"offset\":";
+  json += offset;
+  json += ",\"limit\":";
+  json += limit;
+  json += ",\"commands\":[";
+  long matched = 0;
+  for (size_t i = 0; i < candidateCount && matched < offset + limit; i++) {
+    const IRCommand* cmd = candidateCommand(candidates, i);
+    if (cmd == NULL || !commandMatches(*cmd, protocol, address, command)) {
+      continue;
+    }
+    if (matched++ < offset) {
+      continue;
+    }
+    if (matched > offset + 1) {
+      json += ",";
+    }
+    appendCommandJson(json, *cmd);
+    server.sendContent(json);
+    json = "";
+  }
+  json += "]}";
+  server.sendContent(json);
+  server.sendContent("");
 }
 
-// Function for connecting to WiFi
-bool connectToWiFi() {
-  if (!wifiConfigured || wifi_ssid.length() == 0) {
-    return false;
+// Handler for a single saved command: GET returns it, DELETE removes it
+void handleCommand() {
+  if (!server.hasArg("id")) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"Missing id!\"}");
+    return;
   }
+  uint32_t id = server.arg("id").toInt();
   
-  Serial.println("\nAttempting to connect to WiFi: " + wifi_ssid);
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(wifi_ssid.c_str(), wifi_password.c_str());
-  
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
+  if (server.method() == HTTP_DELETE) {
+    if (!deleteSavedCommand(id)) {
+      server.send(404, "application/json", "{\"success\":false,\"message\":\"Command not found!\"}");
+      return;
+    }
+    server.send(200, "application/json", "{\"success\":true,\"message\":\"Command deleted!\"}");
+    return;
   }
   
-  if (WiFi.status() == WL_CONNECTED) {
-    wifiConnected = true;
-    Serial.println("\n✅ Connected to WiFi!");
-    Serial.print("IP Address: ");
-    Serial.println(WiFi.localIP());
-    return true;
-  } else {
-    Serial.println("\n❌ Could not connect to WiFi");
-    return false;
+  int pos = findCommandPosition(id);
+  if (pos < 0) {
+    server.send(404, "application/json", "{\"success\":false,\"message\":\"Command not found!\"}");
+    return;
   }
+  server.send(200, "application/json", commandToJson(savedCommands[pos]));
 }
 
-// Function for starting Access Point
-void startAccessPoint() {
-  Serial.println("\nStarting Access Point...");
-  WiFi.mode(WIFI_AP);
-  WiFi.softAP(ap_ssid, ap_password);
-  
-  IPAddress IP = WiFi.softAPIP();
-  Serial.print("Access Point created! SSID: ");
-  Serial.println(ap_ssid);
-  Serial.print("Password: ");
+// Canonical IRremote protocol name for an imported protocol name, or NULL if unsupported
+const char* canonicalProtocol(const String& name) {
+  static const char* const aliases[][2] = {
+    {"nec", "NEC"}, {"necext", "NEC"}, {"nec42", "NEC"}, {"nec2", "NEC2"},
+    {"samsung", "Samsung"}, {"samsung32", "Samsung"}, {"samsung48", "Samsung48"},
+    {"sony", "Sony"}, {"sirc", "Sony"}, {"sirc15", "Sony"}, {"sirc20", "Sony"},
+    {"rc5", "RC5"}, {"rc5x", "RC5"}, {"rc6", "RC6"},
+    {"kaseikyo", "Kaseikyo"}, {"panasonic", "Panasonic"}, {"jvc", "JVC"},
+    {"lg", "LG"}, {"denon", "Denon"}, {"sharp", "Sharp"}, {"apple", "Apple"}, {"onkyo", "Onkyo"}
+  };
+  for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+    if (name.equalsIgnoreCase(aliases[i][0])) {
+      return aliases[i][1];
+    }
+  }
+  return NULL;
+}
+
+// FNV-1a hash of protocol/address/command, the library dedup key
+uint32_t libraryHash(const char* protocol, uint16_t address, uint16_t command) {
+  uint32_t hash = 2166136261u;
+  for (const char* p = protocol; *p; p++) {
+    hash = (hash ^ (uint8_t)*p) * 16777619u;
+  }
+  uint8_t bytes[4] = { (uint8_t)address, (uint8_t)(address >> 8), (uint8_t)command, (uint8_t)(command >> 8) };
+  for (int i = 0; i < 4; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+bool readLibraryRecord(File& file, uint32_t index, LibraryRecord& record) {
+  return file.seek(index * sizeof(LibraryRecord)) &&
+         file.read((uint8_t*)&record, sizeof(LibraryRecord)) == sizeof(LibraryRecord);
+}
+
+// Find a code in the library; fills record when found
+bool findLibraryRecord(const char* protocol, uint16_t address, uint16_t command, LibraryRecord* found) {
+  uint32_t hash = libraryHash(protocol, address, command);
+  bool match = false;
+  LibraryRecord record;
+  xSemaphoreTake(libraryMutex, portMAX_DELAY);
+  std::vector<LibraryKey>::iterator it = std::lower_bound(libraryIndex.begin(), libraryIndex.end(), hash,
+    [](const LibraryKey& key, uint32_t value) { return key.hash < value; });
+  if (it != libraryIndex.end() && it->hash == hash) {
+    File file = LittleFS.open(LIBRARY_FILE, FILE_READ);
+    for (; file && it != libraryIndex.end() && it->hash == hash && !match; ++it) {
+      match = readLibraryRecord(file, it->record, record) && record.address == address &&
+              record.command == command && strcmp(record.protocol, protocol) == 0;
+    }
+    if (file) {
+      file.close();
+    }
+  }
+  xSemaphoreGive(libraryMutex);
+  if (match && found != NULL) {
+    *found = record;
+  }
+  return match;
+}
+
+// Make room for `records` index keys in one allocation, as far as the heap allows; returns
+// the capacity. Checked against the largest free block, so it cannot fail or starve the heap.
+uint32_t reserveLibraryIndex(uint32_t records) {
+  records = min(records, LIBRARY_MAX_RECORDS);
+  if (records > libraryIndex.capacity()) {
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t affordable = largest > LIBRARY_HEAP_HEADROOM ? (largest - LIBRARY_HEAP_HEADROOM) / sizeof(LibraryKey) : 0;
+    records = min(records, affordable);
+    if (records > libraryIndex.capacity()) {
+      libraryIndex.reserve(records);
+    }
+  }
+  return libraryIndex.capacity();
+}
+
+// Rebuild the in-RAM library index from flash at boot, sized from the file
+void loadLibraryIndex() {
+  libraryIndex.clear();
+  libraryCount = 0;
+  libraryUnindexed = 0;
+  File file = LittleFS.open(LIBRARY_FILE, FILE_READ);
+  if (!file) {
+    return;
+  }
+  uint32_t capacity = reserveLibraryIndex(file.size() / sizeof(LibraryRecord));
+  LibraryRecord records[IMPORT_BATCH_SIZE];
+  size_t bytes;
+  while ((bytes = file.read((uint8_t*)records, sizeof(records))) >= sizeof(LibraryRecord)) {
+    for (size_t i = 0; i < bytes / sizeof(LibraryRecord); i++) {
+      LibraryKey key = { libraryHash(records[i].protocol, records[i].address, records[i].command), libraryCount++ };
+      if (libraryIndex.size() < capacity) {
+        libraryIndex.push_back(key);
+      } else {
+        libraryUnindexed++;
+      }
+    }
+  }
+  file.close();
+  std::sort(libraryIndex.begin(), libraryIndex.end(),
+    [](const LibraryKey& a, const LibraryKey& b) { return a.hash < b.hash; });
+  Serial.println("Code library: " + String(libraryCount) + " entries");
+  if (libraryUnindexed > 0) {
+    Serial.println("⚠️ Not enough heap to index " + String(libraryUnindexed) + " library entries");
+  }
+}
+
+// Append the current import batch to flash in one write and merge its keys into the index
+void flushImportBatch() {
+  if (importState.batchCount == 0) {
+    return;
+  }
+  File file = LittleFS.open(LIBRARY_FILE, FILE_APPEND);
+  size_t written = file ? file.write((const uint8_t*)importState.batch, importState.batchCount * sizeof(LibraryRecord)) : 0;
+  if (file) {
+    file.close();
+  }
+  int stored = written / sizeof(LibraryRecord);
+  LibraryKey keys[IMPORT_BATCH_SIZE];
+  for (int i = 0; i < stored; i++) {
+    const LibraryRecord& record = importState.batch[i];
+    keys[i].hash = libraryHash(record.protocol, record.address, record.command);
+    keys[i].record = libraryCount++;
+  }
+  std::sort(keys, keys + stored, [](const LibraryKey& a, const LibraryKey& b) { return a.hash < b.hash; });
+  
+  // Merge from the back into the reserved tail: no temporary buffer, no reallocation
+  xSemaphoreTake(libraryMutex, portMAX_DELAY);
+  int oldSize = libraryIndex.size();
+  libraryIndex.resize(oldSize + stored);
+  int from = oldSize - 1;
+  for (int to = oldSize + stored - 1, next = stored - 1; next >= 0; to--) {
+    if (from >= 0 && libraryIndex[from].hash > keys[next].hash) {
+      libraryIndex[to] = libraryIndex[from--];
+    } else {
+      libraryIndex[to] = keys[next--];
+    }
+  }
+  xSemaphoreGive(libraryMutex);
+  importState.imported += stored;
+  importState.rejected += importState.batchCount - stored;
+  importState.batchCount = 0;
+}
+
+// Validate, deduplicate and queue one parsed code for the next batch write
+void importCode(const String& protocolName, uint32_t address, uint32_t command, const String& label) {
+  importState.parsed++;
+  const char* protocol = canonicalProtocol(protocolName);
+  if (protocol == NULL) {
+    importState.unsupported++;
+    return;
+  }
+  if (address > 0xFFFF || command > 0xFFFF) {
+    importState.invalid++;
+    return;
+  }
+  // IRremote reports 8-bit Samsung addresses repeated in both bytes (0x07 -> 0x707)
+  if (strcmp(protocol, "Samsung") == 0 && address <= 0xFF) {
+    address |= address << 8;
+  }
+  
+  // Already saved, already in the library, or repeated within this batch
+  String addressText = "0x" + String(address, HEX);
+  String commandText = "0x" + String(command, HEX);
+  std::map<String, std::vector<uint32_t>>::iterator entry = addressIndex.find(addressText);
+  if (entry != addressIndex.end()) {
+    for (size_t i = 0; i < entry->second.size(); i++) {
+      int pos = findCommandPosition(entry->second[i]);
+      if (pos >= 0 && savedCommands[pos].protocol == protocol && savedCommands[pos].command == commandText) {
+        importState.duplicates++;
+        return;
+      }
+    }
+  }
+  if (findLibraryRecord(protocol, address, command, NULL)) {
+    importState.duplicates++;
+    return;
+  }
+  for (int i = 0; i < importState.batchCount; i++) {
+    const LibraryRecord& queued = importState.batch[i];
+    if (queued.address == address && queued.command == command && strcmp(queued.protocol, protocol) == 0) {
+      importState.duplicates++;
+      return;
+    }
+  }
+  
+  if (libraryCount + importState.batchCount >= LIBRARY_MAX_RECORDS ||
+      libraryIndex.size() + importState.batchCount >= libraryIndex.capacity()) {
+    importState.rejected++;
+    return;
+  }
+  
+  LibraryRecord& record = importState.batch[importState.batchCount++];
+  memset(&record, 0, sizeof(record));
+  strncpy(record.protocol, protocol, sizeof(record.protocol) - 1);
+  record.address = address;
+  record.command = command;
+  strncpy(record.label, label.c_str(), sizeof(record.label) - 1);
+  if (importState.batchCount == IMPORT_BATCH_SIZE) {
+    flushImportBatch();
+  }
+}
+
+// Parse "04 00 00 00" (Flipper little-endian byte list) into a number
+uint32_t parseFlipperBytes(const String& value) {
+  uint32_t result = 0;
+  int shift = 0;
+  const char* p = value.c_str();
+  while (*p && shift < 32) {
+    char* end;
+    unsigned long byteValue = strtoul(p, &end, 16);
+    if (end == p) {
+      break;
+    }
+    result |= (byteValue & 0xFF) << shift;
+    shift += 8;
+    p = end;
+  }
+  return result;
+}
+
+void finishFlipperSignal() {
+  if (importState.flipperName[0] == '\0') {
+    return;
+  }
+  if (!importState.flipperParsed) {
+    importState.parsed++;
+    importState.unsupported++;
+  } else if (!importState.flipperHasAddress || !importState.flipperHasCommand) {
+    importState.parsed++;
+    importState.invalid++;
+  } else {
+    importCode(importState.flipperProtocol, importState.flipperAddress & 0xFFFF,
+               importState.flipperCommand & 0xFFFF, importState.flipperName);
+  }
+  importState.flipperName[0] = '\0';
+  importState.flipperProtocol[0] = '\0';
+  importState.flipperParsed = importState.flipperHasAddress = importState.flipperHasCommand = false;
+}
+
+// Flipper Zero .ir: "key: value" blocks separated by "#" lines
+void parseFlipperLine(const String& line) {
+  if (line.startsWith("#")) {
+    finishFlipperSignal();
+    return;
+  }
+  int colon = line.indexOf(':');
+  if (colon < 0) {
+    return;
+  }
+  String key = line.substring(0, colon);
+  String value = line.substring(colon + 1);
+  key.trim();
+  value.trim();
+  if (key == "name") {
+    finishFlipperSignal();
+    strncpy(importState.flipperName, value.c_str(), sizeof(importState.flipperName) - 1);
+    importState.flipperName[sizeof(importState.flipperName) - 1] = '\0';
+  } else if (key == "type") {
+    importState.flipperParsed = value == "parsed";
+  } else if (key == "protocol") {
+    strncpy(importState.flipperProtocol, value.c_str(), sizeof(importState.flipperProtocol) - 1);
+    importState.flipperProtocol[sizeof(importState.flipperProtocol) - 1] = '\0';
+  } else if (key == "address") {
+    importState.flipperAddress = parseFlipperBytes(value);
+    importState.flipperHasAddress = true;
+  } else if (key == "command") {
+    importState.flipperCommand = parseFlipperBytes(value);
+    importState.flipperHasCommand = true;
+  }
+}
+
+uint8_t reverseBits8(uint8_t value) {
+  value = (value & 0xF0) >> 4 | (value & 0x0F) << 4;
+  value = (value & 0xCC) >> 2 | (value & 0x33) << 2;
+  value = (value & 0xAA) >> 1 | (value & 0x55) << 1;
+  return value;
+}
+
+// Translate one LIRC code (sent MSB first) into IRremote's LSB-first address/command
+void importLircCode(const String& name, uint32_t code) {
+  uint8_t totalBits = importState.lircPreDataBits + importState.lircBits;
+  // A 32-bit code leaves no room for pre_data, and shifting by the full width is undefined
+  uint32_t preData = importState.lircBits < 32 ? importState.lircPreData << importState.lircBits : 0;
+  uint32_t value = preData | code;
+  String flags = importState.lircFlags;
+  
+  if (flags.indexOf("RC5") >= 0 && totalBits >= 11) {
+    // Field bit, toggle, 5 address bits, 6 command bits; an inverted field bit extends the command
+    uint32_t command = value & 0x3F;
+    if (totalBits >= 13 && !(value & (1UL << 12))) {
+      command |= 0x40;
+    }
+    importCode("RC5", (value >> 6) & 0x1F, command, name);
+  } else if (flags.indexOf("RC6") >= 0) {
+    importCode("RC6", (value >> 8) & 0xFF, value & 0xFF, name);
+  } else if (totalBits == 32 && importState.lircHeaderMark > 7000) {
+    uint8_t address = reverseBits8(value >> 24);
+    uint8_t addressHigh = reverseBits8(value >> 16);
+    uint16_t fullAddress = addressHigh == (uint8_t)~address ? address : (address | (addressHigh << 8));
+    importCode("NEC", fullAddress, reverseBits8(value >> 8), name);
+  } else if (totalBits == 32 && importState.lircHeaderMark > 3500) {
+    importCode("Samsung", reverseBits8(value >> 24) | (reverseBits8(value >> 16) << 8), reverseBits8(value >> 8), name);
+  } else if ((totalBits == 12 || totalBits == 15 || totalBits == 20) && importState.lircHeaderMark > 2000) {
+    // SIRC: 7 command bits then address, LSB first
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < totalBits; i++) {
+      reversed = (reversed << 1) | ((value >> i) & 1);
+    }
+    importCode("Sony", reversed >> 7, reversed & 0x7F, name);
+  } else {
+    importState.parsed++;
+    importState.unsupported++;
+  }
+}
+
+// LIRC lircd.conf: "begin remote" sections with timing parameters and a codes list
+void parseLircLine(const String& line) {
+  if (line.startsWith("#")) {
+    return;
+  }
+  char first[32] = "";
+  char second[48] = "";
+  char third[16] = "";
+  sscanf(line.c_str(), "%31s %47s %15s", first, second, third);
+  String key = first;
+  
+  if (key == "begin") {
+    if (strcmp(second, "remote") == 0) {
+      importState.lircInCodes = importState.lircInRaw = false;
+      importState.lircFlags[0] = '\0';
+      importState.lircHeaderMark = importState.lircHeaderSpace = 0;
+      importState.lircBits = importState.lircPreDataBits = 0;
+      importState.lircPreData = 0;
+    } else if (strcmp(second, "codes") == 0) {
+      importState.lircInCodes = true;
+    } else if (strcmp(second, "raw_codes") == 0) {
+      importState.lircInRaw = true;
+    }
+  } else if (key == "end") {
+    importState.lircInCodes = importState.lircInRaw = false;
+  } else if (importState.lircInRaw) {
+    if (key == "name") {
+      importState.parsed++;
+      importState.unsupported++;
+    }
+  } else if (importState.lircInCodes) {
+    char* end;
+    uint32_t code = strtoul(second, &end, 0);
+    if (end == second) {
+      importState.parsed++;
+      importState.invalid++;
+    } else {
+      importLircCode(key, code);
+    }
+  } else if (key == "flags") {
+    strncpy(importState.lircFlags, second, sizeof(importState.lircFlags) - 1);
+    importState.lircFlags[sizeof(importState.lircFlags) - 1] = '\0';
+  } else if (key == "header") {
+    importState.lircHeaderMark = atoi(second);
+    importState.lircHeaderSpace = atoi(third);
+  } else if (key == "bits") {
+    importState.lircBits = atoi(second);
+  } else if (key == "pre_data_bits") {
+    importState.lircPreDataBits = atoi(second);
+  } else if (key == "pre_data") {
+    importState.lircPreData = strtoul(second, NULL, 0);
+  }
+}
+
+// Parse a decimal or 0x-prefixed hex number that fills the whole field ("08" is eight)
+bool parseImportNumber(const String& text, uint32_t& value) {
+  bool hex = text.startsWith("0x") || text.startsWith("0X");
+  const char* digits = text.c_str() + (hex ? 2 : 0);
+  if (hex ? !isxdigit((unsigned char)*digits) : !isdigit((unsigned char)*digits)) {
+    return false;
+  }
+  char* end;
+  value = strtoul(digits, &end, hex ? 16 : 10);
+  return *end == '\0';
+}
+
+// CSV: protocol,address,command[,label]; a header line is skipped as unsupported
+void parseCsvLine(const String& line) {
+  if (line.startsWith("#")) {
+    return;
+  }
+  int first = line.indexOf(',');
+  int second = first >= 0 ? line.indexOf(',', first + 1) : -1;
+  if (second < 0) {
+    importState.parsed++;
+    importState.invalid++;
+    return;
+  }
+  int third = line.indexOf(',', second + 1);
+  String protocol = line.substring(0, first);
+  String address = line.substring(first + 1, second);
+  String command = third >= 0 ? line.substring(second + 1, third) : line.substring(second + 1);
+  String label = third >= 0 ? line.substring(third + 1) : "";
+  protocol.trim();
+  address.trim();
+  command.trim();
+  label.trim();
+  if (protocol.equalsIgnoreCase("protocol")) {
+    return;
+  }
+  uint32_t addressValue, commandValue;
+  if (!parseImportNumber(address, addressValue) || !parseImportNumber(command, commandValue)) {
+    importState.parsed++;
+    importState.invalid++;
+    return;
+  }
+  importCode(protocol, addressValue, commandValue, label);
+}
+
+// Value of a flat JSON field (string or number) from one JSON Lines object
+String jsonLineField(const String& line, const char* name) {
+  String key = "\"" + String(name) + "\"";
+  int pos = line.indexOf(key);
+  if (pos < 0) {
+    return "";
+  }
+  pos = line.indexOf(':', pos + key.length());
+  if (pos < 0) {
+    return "";
+  }
+  pos++;
+  while (pos < (int)line.length() && line[pos] == ' ') {
+    pos++;
+  }
+  if (pos < (int)line.length() && line[pos] == '"') {
+    int end = line.indexOf('"', pos + 1);
+    return end < 0 ? "" : line.substring(pos + 1, end);
+  }
+  int end = pos;
+  while (end < (int)line.length() && line[end] != ',' && line[end] != '}' && line[end] != ' ') {
+    end++;
+  }
+  return line.substring(pos, end);
+}
+
+void parseJsonLine(const String& line) {
+  String protocol = jsonLineField(line, "protocol");
+  String address = jsonLineField(line, "address");
+  String command = jsonLineField(line, "command");
+  uint32_t addressValue, commandValue;
+  if (protocol.length() == 0 || !parseImportNumber(address, addressValue) || !parseImportNumber(command, commandValue)) {
+    importState.parsed++;
+    importState.invalid++;
+    return;
+  }
+  importCode(protocol, addressValue, commandValue, jsonLineField(line, "label"));
+}
+
+const char* importFormatName(ImportFormat format) {
+  switch (format) {
+    case IMPORT_JSONL: return "jsonl";
+    case IMPORT_FLIPPER: return "flipper";
+    case IMPORT_LIRC: return "lirc";
+    default: return "csv";
+  }
+}
+
+void processImportLine() {
+  String line = String(importState.line);
+  line.trim();
+  if (line.length() == 0) {
+    return;
+  }
+  // Without an explicit format, sniff it from the first meaningful line
+  if (!importState.detected) {
+    importState.detected = true;
+    if (line.startsWith("Filetype:")) {
+      importState.format = IMPORT_FLIPPER;
+    } else if (line.startsWith("{")) {
+      importState.format = IMPORT_JSONL;
+    } else if (line.startsWith("#") || line.startsWith("begin")) {
+      importState.format = IMPORT_LIRC;
+    } else {
+      importState.format = IMPORT_CSV;
+    }
+  }
+  switch (importState.format) {
+    case IMPORT_FLIPPER: parseFlipperLine(line); break;
+    case IMPORT_LIRC: parseLircLine(line); break;
+    case IMPORT_JSONL: parseJsonLine(line); break;
+    default: parseCsvLine(line); break;
+  }
+}
+
+void beginImport(const String& filename, const String& format) {
+  memset(&importState, 0, sizeof(importState));
+  importState.active = true;
+  importState.startTime = millis();
+  reserveLibraryIndex(libraryIndex.size() + LIBRARY_IMPORT_RESERVE);
+  
+  String name = filename;
+  name.toLowerCase();
+  String requested = format.length() > 0 ? format : name.substring(name.lastIndexOf('.') + 1);
+  importState.detected = true;
+  if (requested == "ir" || requested == "flipper") {
+    importState.format = IMPORT_FLIPPER;
+  } else if (requested == "conf" || requested == "lirc" || requested == "lircd") {
+    importState.format = IMPORT_LIRC;
+  } else if (requested == "jsonl" || requested == "json") {
+    importState.format = IMPORT_JSONL;
+  } else if (requested == "csv") {
+    importState.format = IMPORT_CSV;
+  } else {
+    importState.detected = false;
+  }
+}
+
+// Feed an upload chunk through the fixed line buffer
+void feedImport(const uint8_t* data, size_t length) {
+  importState.bytes += length;
+  for (size_t i = 0; i < length; i++) {
+    char c = data[i];
+    if (c == '\n') {
+      importState.line[importState.lineLength] = '\0';
+      if (importState.lineOverflow) {
+        importState.parsed++;
+        importState.invalid++;
+      } else {
+        processImportLine();
+      }
+      importState.lineLength = 0;
+      importState.lineOverflow = false;
+    } else if (c != '\r') {
+      if (importState.lineLength < IMPORT_LINE_LENGTH - 1) {
+        importState.line[importState.lineLength++] = c;
+      } else {
+        importState.lineOverflow = true;
+      }
+    }
+  }
+}
+
+void finishImport() {
+  if (importState.lineLength > 0) {
+    uint8_t newline = '\n';
+    feedImport(&newline, 1);
+  }
+  if (importState.format == IMPORT_FLIPPER) {
+    finishFlipperSignal();
+  }
+  flushImportBatch();
+}
+
+// Upload callback for /import: parses the file as it streams in
+void handleImportUpload() {
+  HTTPUpload& upload = server.upload();
+  if (upload.status == UPLOAD_FILE_START) {
+    beginImport(upload.filename, server.arg("format"));
+  } else if (upload.status == UPLOAD_FILE_WRITE && importState.active) {
+    feedImport(upload.buf, upload.currentSize);
+  } else if (upload.status == UPLOAD_FILE_END && importState.active) {
+    finishImport();
+  } else if (upload.status == UPLOAD_FILE_ABORTED && importState.active) {
+    flushImportBatch();
+    importState.active = false;
+  }
+}
+
+// Handler for bulk import of code libraries (multipart upload)
+void handleImport() {
+  if (!importState.active) {
+    server.send(400, "application/json", "{\"success\":false,\"message\":\"No file uploaded!\"}");
+    return;
+  }
+  importState.active = false;
+  
+  unsigned long elapsed = millis() - importState.startTime;
+  String json = "{";
+  json += "\"success\":true,";
+  json += "\"format\":\"" + String(importFormatName(importState.format)) + "\",";
+  json += "\"bytes\":" + String((unsigned long)importState.bytes) + ",";
+  json += "\"parsed\":" + String(importState.parsed) + ",";
+  json += "\"imported\":" + String(importState.imported) + ",";
+  json += "\"duplicates\":" + String(importState.duplicates) + ",";
+  json += "\"invalid\":" + String(importState.invalid) + ",";
+  json += "\"unsupported\":" + String(importState.unsupported) + ",";
+  json += "\"rejected\":" + String(importState.rejected) + ",";
+  json += "\"library\":" + String(libraryCount) + ",";
+  json += "\"ms\":" + String(elapsed) + ",";
+  json += "\"entriesPerSecond\":" + String(elapsed > 0 ? importState.parsed * 1000.0 / elapsed : 0.0, 1);
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+// Handler for paginated listing of the imported library (JSON)
+void handleLibrary() {
+  long offset = server.hasArg("offset") ? server.arg("offset").toInt() : 0;
+  long limit = server.hasArg("limit") ? server.arg("limit").toInt() : COMMANDS_DEFAULT_LIMIT;
+  if (offset < 0) {
+    offset = 0;
+  }
+  if (limit <= 0 || limit > COMMANDS_MAX_LIMIT) {
+    limit = COMMANDS_MAX_LIMIT;
+  }
+  
+  String items = "";
+  File file = LittleFS.open(LIBRARY_FILE, FILE_READ);
+  if (file) {
+    LibraryRecord record;
+    for (long i = offset; i < offset + limit && i < (long)libraryCount; i++) {
+      if (!readLibraryRecord(file, i, record)) {
+        break;
+      }
+      if (items.length() > 0) {
+        items += ",";
+      }
+      items += "{\"index\":" + String(i) + ",\"protocol\":\"" + String(record.protocol) + "\",";
+      items += "\"address\":\"0x" + String(record.address, HEX) + "\",\"command\":\"0x" + String(record.command, HEX) + "\",";
+      items += "\"label\":\"" + jsonEscape(record.label) + "\"}";
+    }
+    file.close();
+  }
+  
+  String json = "{\"total\":" + String(libraryCount) + ",\"unindexed\":" + String(libraryUnindexed);
+  json += ",\"offset\":" + String(offset) + ",\"limit\":" + String(limit);
+  json += ",\"codes\":[" + items + "]}";
+  server.send(200, "application/json", json);
+}
+
+// Handler for deleting the imported library
+void handleLibraryClear() {
+  xSemaphoreTake(libraryMutex, portMAX_DELAY);
+  LittleFS.remove(LIBRARY_FILE);
+  libraryIndex.clear();
+  libraryCount = 0;
+  libraryUnindexed = 0;
+  xSemaphoreGive(libraryMutex);
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Code library deleted!\"}");
+}
+
+// Nominal mark/space durations (microseconds) per protocol, 0-terminated
+struct ProtocolTiming {
+  decode_type_t protocol;
+  uint16_t marks[4];
+  uint16_t spaces[5];
+};
+
+const ProtocolTiming protocolTimings[] = {
+  { NEC,      { 9000, 560 },        { 4500, 2250, 1690, 560 } },
+  { NEC2,     { 9000, 560 },        { 4500, 2250, 1690, 560 } },
+  { APPLE,    { 9000, 560 },        { 4500, 2250, 1690, 560 } },
+  { ONKYO,    { 9000, 560 },        { 4500, 2250, 1690, 560 } },
+  { SAMSUNG,  { 4500, 560 },        { 4500, 1690, 560 } },
+  { SAMSUNGLG, { 4500, 560 },       { 4500, 1690, 560 } },
+  { SAMSUNG48, { 4500, 560 },       { 4500, 1690, 560 } },
+  { SONY,     { 2400, 1200, 600 },  { 600 } },
+  { RC5,      { 1778, 889 },        { 1778, 889 } },
+  { RC6,      { 2666, 1333, 889, 444 }, { 1333, 889, 444 } },
+  { KASEIKYO, { 3456, 432 },        { 1728, 1296, 432 } },
+  { PANASONIC, { 3456, 432 },       { 1728, 1296, 432 } },
+  { JVC,      { 8400, 526 },        { 4200, 1578, 526 } },
+  { LG,       { 9000, 500 },        { 4200, 2250, 1500, 500 } },
+  { DENON,    { 260 },              { 1820, 780 } },
+  { SHARP,    { 260 },              { 1820, 780 } },
+};
+
+void updateRunningStat(RunningStat& stat, int32_t value) {
+  stat.count++;
+  stat.sum += value;
+  stat.sumSquares += (uint64_t)((int64_t)value * value);
+}
+
+double runningMean(const RunningStat& stat) {
+  return stat.count > 0 ? (double)stat.sum / stat.count : 0.0;
+}
+
+double runningStdDev(const RunningStat& stat) {
+  if (stat.count < 2) {
+    return 0.0;
+  }
+  double variance = ((double)stat.sumSquares - (double)stat.sum * stat.sum / stat.count) / (stat.count - 1);
+  return variance > 0 ? sqrt(variance) : 0.0;
+}
+
+// Signed difference to the closest nominal duration
+int nearestDeviation(uint32_t duration, const uint16_t* nominal, int size) {
+  int best = 0;
+  uint32_t bestDistance = UINT32_MAX;
+  for (int i = 0; i < size && nominal[i] != 0; i++) {
+    int deviation = (int)duration - nominal[i];
+    uint32_t distance = deviation < 0 ? -deviation : deviation;
+    if (distance < bestDistance) {
+      bestDistance = distance;
+      best = deviation;
+    }
+  }
+  return best;
+}
+
+void recordJitter(SignalStats& stats, int deviation, bool mark) {
+  updateRunningStat(mark ? stats.markJitter : stats.spaceJitter, deviation);
+  int bucket = (deviation < 0 ? -deviation : deviation) / JITTER_BUCKET_US;
+  stats.jitterHistogram[bucket < JITTER_BUCKETS ? bucket : JITTER_BUCKETS - 1]++;
+}
+
+// Stats slot for a code; reuses the least recently seen slot when the table is full
+SignalStats& codeStatsFor(decode_type_t protocol, uint16_t address, uint16_t command) {
+  int oldest = 0;
+  for (int i = 0; i < codeStatsCount; i++) {
+    if (codeStats[i].protocol == protocol && codeStats[i].address == address && codeStats[i].command == command) {
+      return codeStats[i].stats;
+    }
+    if (codeStats[i].stats.lastSeen < codeStats[oldest].stats.lastSeen) {
+      oldest = i;
+    }
+  }
+  int slot = codeStatsCount < MAX_CODE_STATS ? codeStatsCount++ : oldest;
+  memset(&codeStats[slot], 0, sizeof(CodeStats));
+  codeStats[slot].protocol = protocol;
+  codeStats[slot].address = address;
+  codeStats[slot].command = command;
+  return codeStats[slot].stats;
+}
+
+void recordFrame(SignalStats& stats, uint8_t flags, unsigned long now) {
+  if (stats.frames > 0 && now - stats.lastSeen <= INTER_FRAME_GAP_MAX_MS) {
+    updateRunningStat(stats.frameGap, now - stats.lastSeen);
+  }
+  stats.frames++;
+  stats.lastSeen = now;
+  if (flags & IRDATA_FLAGS_IS_REPEAT) {
+    stats.repeats++;
+  }
+  if (flags & IRDATA_FLAGS_WAS_OVERFLOW) {
+    stats.overflows++;
+  }
+  if (flags & IRDATA_FLAGS_PARITY_FAILED) {
+    stats.parityErrors++;
+  }
+}
+
+// Update device and per-code statistics from the frame still held in the receive buffer
+void recordSignalStats() {
+  const IRData& data = IrReceiver.decodedIRData;
+  unsigned long now = millis();
+  recordFrame(deviceStats, data.flags, now);
+  if (data.protocol == UNKNOWN) {
+    // decodeHash() also reports UNKNOWN, but leaves its hash in decodedRawData
+    if (data.decodedRawData != 0) {
+      hashFrames++;
+    } else {
+      decodeFailures++;
+    }
+    return;
+  }
+  
+  SignalStats& stats = codeStatsFor(data.protocol, data.address, data.command);
+  recordFrame(stats, data.flags, now);
+  
+  const ProtocolTiming* timing = NULL;
+  for (size_t i = 0; i < sizeof(protocolTimings) / sizeof(protocolTimings[0]); i++) {
+    if (protocolTimings[i].protocol == data.protocol) {
+      timing = &protocolTimings[i];
+      break;
+    }
+  }
+  if (timing == NULL || data.rawDataPtr == NULL || (data.flags & IRDATA_FLAGS_WAS_OVERFLOW)) {
+    return;
+  }
+  
+  // rawbuf[0] is the gap before the frame; odd entries are marks, even entries spaces
+  for (uint_fast16_t i = 1; i < data.rawDataPtr->rawlen; i++) {
+    uint32_t duration = (uint32_t)data.rawDataPtr->rawbuf[i] * MICROS_PER_TICK;
+    bool mark = i & 1;
+    int deviation = mark ? nearestDeviation(duration, timing->marks, 4) : nearestDeviation(duration, timing->spaces, 5);
+    recordJitter(stats, deviation, mark);
+    recordJitter(deviceStats, deviation, mark);
+  }
+}
+
+// unit divides the recorded integers, e.g. 1000 to show microseconds as milliseconds
+String runningStatToJson(const RunningStat& stat, double unit = 1) {
+  return "{\"count\":" + String(stat.count) + ",\"mean\":" + String(runningMean(stat) / unit, 1) +
+         ",\"stddev\":" + String(runningStdDev(stat) / unit, 1) + "}";
+}
+
+String signalStatsToJson(const SignalStats& stats) {
+  String json = "\"frames\":" + String(stats.frames) + ",";
+  json += "\"repeats\":" + String(stats.repeats) + ",";
+  json += "\"overflows\":" + String(stats.overflows) + ",";
+  json += "\"parityErrors\":" + String(stats.parityErrors) + ",";
+  json += "\"markJitter\":" + runningStatToJson(stats.markJitter) + ",";
+  json += "\"spaceJitter\":" + runningStatToJson(stats.spaceJitter) + ",";
+  json += "\"frameGapMs\":" + runningStatToJson(stats.frameGap) + ",";
+  json += "\"jitterHistogram\":[";
+  for (int i = 0; i < JITTER_BUCKETS; i++) {
+    json += String(stats.jitterHistogram[i]) + (i < JITTER_BUCKETS - 1 ? "," : "");
+  }
+  json += "],\"lastSeenMs\":" + String(stats.lastSeen);
+  return json;
+}
+
+// Handler for signal quality statistics (JSON)
+void handleStats() {
+  String json = "{\"device\":{";
+  json += signalStatsToJson(deviceStats) + ",";
+  json += "\"decodeFailures\":" + String(decodeFailures) + ",";
+  json += "\"hashFrames\":" + String(hashFrames) + ",";
+  json += "\"failureRatio\":" + String(deviceStats.frames > 0 ? (float)decodeFailures / deviceStats.frames : 0.0f, 3);
+  json += "},\"jitterBucketUs\":" + String(JITTER_BUCKET_US) + ",\"codes\":[";
+  for (int i = 0; i < codeStatsCount; i++) {
+    const CodeStats& code = codeStats[i];
+    if (i > 0) {
+      json += ",";
+    }
+    json += "{\"protocol\":\"" + String(getProtocolString(code.protocol)) + "\",";
+    json += "\"address\":\"0x" + String(code.address, HEX) + "\",";
+    json += "\"command\":\"0x" + String(code.command, HEX) + "\",";
+    json += signalStatsToJson(code.stats) + ",";
+    json += "\"parityErrorRatio\":" + String(code.stats.frames > 0 ? (float)code.stats.parityErrors / code.stats.frames : 0.0f, 3) + "}";
+  }
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+// Handler for resetting signal quality statistics
+void handleStatsClear() {
+  memset(&deviceStats, 0, sizeof(deviceStats));
+  memset(codeStats, 0, sizeof(codeStats));
+  codeStatsCount = 0;
+  decodeFailures = 0;
+  hashFrames = 0;
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Statistics cleared!\"}");
+}
+
+// Milliseconds since boot, immune to the millis() wrap as long as it is called at least every 49 days
+uint64_t uptimeMillis() {
+  unsigned long now = millis();
+  uptimeMs += (unsigned long)(now - clockLastMillis);
+  clockLastMillis = now;
+  return uptimeMs;
+}
+
+// Seconds on the time-series timeline: uptime until NTP syncs, Unix time afterwards
+uint32_t timelineSeconds() {
+  return uptimeMillis() / 1000 + timelineOffset;
+}
+
+uint16_t* tierBuckets(TimeSeries& series, int tier) {
+  return tier == TIER_MINUTE ? series.minutes : tier == TIER_HOUR ? series.hours : series.days;
+}
+
+// Move every tier forward to the current time, clearing buckets that were skipped
+void advanceTimeSeries(uint32_t now) {
+  for (int tier = 0; tier < TIER_COUNT; tier++) {
+    uint32_t index = now / tierSeconds[tier];
+    if (index <= timeSeriesHead[tier]) {
+      continue;
+    }
+    uint32_t steps = min(index - timeSeriesHead[tier], (uint32_t)tierSize[tier]);
+    for (int i = 0; i < MAX_TIME_SERIES; i++) {
+      if (timeSeries[i].kind == SERIES_UNUSED) {
+        continue;
+      }
+      uint16_t* buckets = tierBuckets(timeSeries[i], tier);
+      for (uint32_t k = 1; k <= steps; k++) {
+        buckets[(timeSeriesHead[tier] + k) % tierSize[tier]] = 0;
+      }
+    }
+    timeSeriesHead[tier] = index;
+  }
+}
+
+// Series for a code; reuses the least recently seen slot when the table is full
+TimeSeries& timeSeriesFor(decode_type_t protocol, uint16_t address, uint16_t command) {
+  int oldest = 1;
+  for (int i = 1; i < MAX_TIME_SERIES; i++) {
+    TimeSeries& series = timeSeries[i];
+    if (series.kind == SERIES_CODE && series.protocol == protocol && series.address == address && series.command == command) {
+      return series;
+    }
+    if (series.kind == SERIES_UNUSED) {
+      oldest = i;
+      break;
+    }
+    if (series.lastSeen < timeSeries[oldest].lastSeen) {
+      oldest = i;
+    }
+  }
+  TimeSeries& series = timeSeries[oldest];
+  memset(&series, 0, sizeof(TimeSeries));
+  series.kind = SERIES_CODE;
+  series.protocol = protocol;
+  series.address = address;
+  series.command = command;
+  return series;
+}
+
+void countTimeSeriesEvent(TimeSeries& series, uint32_t now) {
+  series.lastSeen = now;
+  for (int tier = 0; tier < TIER_COUNT; tier++) {
+    uint32_t index = now / tierSeconds[tier];
+    if (index > timeSeriesHead[tier] || timeSeriesHead[tier] - index >= (uint32_t)tierSize[tier]) {
+      continue;
+    }
+    uint16_t& bucket = tierBuckets(series, tier)[index % tierSize[tier]];
+    if (bucket < UINT16_MAX) {
+      bucket++;
+    }
+  }
+}
+
+void recordTimeSeriesEvent(decode_type_t protocol, uint16_t address, uint16_t command) {
+  uint32_t now = timelineSeconds();
+  advanceTimeSeries(now);
+  countTimeSeriesEvent(timeSeries[0], now);
+  countTimeSeriesEvent(timeSeriesFor(protocol, address, command), now);
+}
+
+// Add saved buckets that are still inside the live window into a live series
+void mergeTimeSeries(TimeSeries& live, TimeSeries& saved, const uint32_t savedHead[TIER_COUNT]) {
+  for (int tier = 0; tier < TIER_COUNT; tier++) {
+    uint16_t* source = tierBuckets(saved, tier);
+    uint16_t* target = tierBuckets(live, tier);
+    for (int k = 0; k < tierSize[tier] && (uint32_t)k <= savedHead[tier]; k++) {
+      uint32_t index = savedHead[tier] - k;
+      if (index > timeSeriesHead[tier] || timeSeriesHead[tier] - index >= (uint32_t)tierSize[tier]) {
+        continue;
+      }
+      uint32_t sum = (uint32_t)target[index % tierSize[tier]] + source[index % tierSize[tier]];
+      target[index % tierSize[tier]] = sum < UINT16_MAX ? sum : UINT16_MAX;
+    }
+  }
+  live.lastSeen = max(live.lastSeen, saved.lastSeen);
+}
+
+// While wall-clock history waits for NTP (which never comes in access point mode), the live
+// counters go to a separate file on the device timeline instead of overwriting it
+void persistTimeSeries() {
+  if (!flashMounted) {
+    return;
+  }
+  File file = LittleFS.open(timeSeriesRestorePending ? TIMESERIES_LIVE_FILE : TIMESERIES_FILE, FILE_WRITE);
+  if (!file) {
+    return;
+  }
+  uint32_t magic = TIMESERIES_MAGIC;
+  uint16_t version = TIMESERIES_VERSION;
+  uint8_t wallClock = wallClockValid;
+  uint8_t count = MAX_TIME_SERIES;
+  uint32_t now = timelineSeconds();
+  file.write((const uint8_t*)&magic, sizeof(magic));
+  file.write((const uint8_t*)&version, sizeof(version));
+  file.write(&wallClock, 1);
+  file.write(&count, 1);
+  file.write((const uint8_t*)&now, sizeof(now));
+  file.write((const uint8_t*)timeSeriesHead, sizeof(timeSeriesHead));
+  file.write((const uint8_t*)timeSeries, sizeof(timeSeries));
+  file.close();
+  lastTimeSeriesPersist = millis();
+  
+  // The device-time file was merged into the live counters, which now include the history
+  if (!timeSeriesRestorePending && LittleFS.exists(TIMESERIES_LIVE_FILE)) {
+    LittleFS.remove(TIMESERIES_LIVE_FILE);
+  }
+}
+
+// Merge one persisted counter file. Without wall-clock time the timeline resumes where the last
+// boot stopped (downtime is not counted); false when the file has wall-clock buckets and NTP
+// has not synced yet
+bool restoreTimeSeriesFile(const char* path) {
+  File file = LittleFS.open(path, FILE_READ);
+  if (!file) {
+    return true;
+  }
+  uint32_t magic = 0;
+  uint16_t version = 0;
+  uint8_t wallClock = 0;
+  uint8_t count = 0;
+  uint32_t savedNow = 0;
+  uint32_t savedHead[TIER_COUNT];
+  file.read((uint8_t*)&magic, sizeof(magic));
+  file.read((uint8_t*)&version, sizeof(version));
+  file.read(&wallClock, 1);
+  file.read(&count, 1);
+  file.read((uint8_t*)&savedNow, sizeof(savedNow));
+  if (magic != TIMESERIES_MAGIC || version != TIMESERIES_VERSION ||
+      file.read((uint8_t*)savedHead, sizeof(savedHead)) != sizeof(savedHead)) {
+    file.close();
+    return true;
+  }
+  if (wallClock && !wallClockValid) {
+    file.close();
+    return false;
+  }
+  
+  uint32_t uptime = uptimeMillis() / 1000;
+  if (!wallClock && !wallClockValid && savedNow > uptime) {
+    timelineOffset = savedNow - uptime;
+    for (int tier = 0; tier < TIER_COUNT; tier++) {
+      timeSeriesHead[tier] = max(timeSeriesHead[tier], savedHead[tier]);
+    }
+  }
+  advanceTimeSeries(timelineSeconds());
+  TimeSeries saved;
+  for (int i = 0; i < count && file.read((uint8_t*)&saved, sizeof(saved)) == sizeof(saved); i++) {
+    if (saved.kind == SERIES_ALL) {
+      mergeTimeSeries(timeSeries[0], saved, savedHead);
+    } else if (saved.kind == SERIES_CODE) {
+      mergeTimeSeries(timeSeriesFor(saved.protocol, saved.address, saved.command), saved, savedHead);
+    }
+  }
+  file.close();
+  Serial.println("Time series restored from " + String(path));
+  return true;
+}
+
+void restoreTimeSeries() {
+  timeSeriesRestorePending = !restoreTimeSeriesFile(TIMESERIES_FILE);
+}
+
+// Switch the timeline to Unix time once NTP has synced, moving existing buckets with it
+void checkWallClock() {
+  time_t now = time(NULL);
+  if (wallClockValid || now < WALL_CLOCK_MIN) {
+    return;
+  }
+  uint32_t uptime = uptimeMillis() / 1000;
+  uint32_t delta = (uint32_t)now - uptime - timelineOffset;
+  for (int tier = 0; tier < TIER_COUNT; tier++) {
+    uint32_t bucketShift = delta / tierSeconds[tier];
+    uint32_t slotShift = bucketShift % tierSize[tier];
+    timeSeriesHead[tier] += bucketShift;
+    for (int i = 0; i < MAX_TIME_SERIES && slotShift > 0; i++) {
+      uint16_t* buckets = tierBuckets(timeSeries[i], tier);
+      std::rotate(buckets, buckets + tierSize[tier] - slotShift, buckets + tierSize[tier]);
+    }
+  }
+  for (int i = 0; i < MAX_TIME_SERIES; i++) {
+    if (timeSeries[i].kind != SERIES_UNUSED) {
+      timeSeries[i].lastSeen += delta;
+    }
+  }
+  timelineOffset = (uint32_t)now - uptime;
+  wallClockValid = true;
+  Serial.println("Wall-clock time synced via NTP");
+  if (timeSeriesRestorePending) {
+    restoreTimeSeries();
+  }
+}
+
+// Periodic time-series work from loop(): clock sync and lazy persistence
+void serviceTimeSeries() {
+  checkWallClock();
+  if (millis() - lastTimeSeriesPersist >= TIMESERIES_PERSIST_MS) {
+    advanceTimeSeries(timelineSeconds());
+    persistTimeSeries();
+  }
+}
+
+void beginTimeSeries() {
+  memset(timeSeries, 0, sizeof(timeSeries));
+  timeSeries[0].kind = SERIES_ALL;
+  clockLastMillis = millis();
+  uint32_t now = timelineSeconds();
+  for (int tier = 0; tier < TIER_COUNT; tier++) {
+    timeSeriesHead[tier] = now / tierSeconds[tier];
+  }
+  if (wifiConnected) {
+    configTime(0, 0, NTP_SERVER);
+  }
+  if (flashMounted) {
+    restoreTimeSeries();
+    restoreTimeSeriesFile(TIMESERIES_LIVE_FILE);
+  }
+  lastTimeSeriesPersist = millis();
+}
+
+// Handler for time-series queries: /timeseries?code=&from=&to=&step=
+void handleTimeSeries() {
+  uint32_t now = timelineSeconds();
+  advanceTimeSeries(now);
+  
+  // "all" or protocol_address_command, as used by the web interface
+  String code = server.hasArg("code") ? server.arg("code") : "all";
+  TimeSeries* series = NULL;
+  if (code == "all") {
+    series = &timeSeries[0];
+  } else {
+    int commandSep = code.lastIndexOf('_');
+    int addressSep = commandSep > 0 ? code.substring(0, commandSep).lastIndexOf('_') : -1;
+    if (addressSep > 0) {
+      String protocol = code.substring(0, addressSep);
+      uint16_t address = strtoul(code.substring(addressSep + 1, commandSep).c_str(), NULL, 0);
+      uint16_t command = strtoul(code.substring(commandSep + 1).c_str(), NULL, 0);
+      for (int i = 1; i < MAX_TIME_SERIES; i++) {
+        if (timeSeries[i].kind == SERIES_CODE && timeSeries[i].address == address && timeSeries[i].command == command &&
+            protocol == getProtocolString(timeSeries[i].protocol)) {
+          series = &timeSeries[i];
+          break;
+        }
+      }
+    }
+  }
+  if (series == NULL) {
+    server.send(404, "application/json", "{\"success\":false,\"message\":\"No data for this code!\"}");
+    return;
+  }
+  
+  // Step: seconds or minute/hour/day; served from the coarsest tier that divides it
+  String stepArg = server.arg("step");
+  uint32_t step = stepArg == "hour" ? 3600 : stepArg == "day" ? 86400 : stepArg == "minute" ? 60 : stepArg.toInt();
+  if (step < 60) {
+    step = 60;
+  }
+  int tier = TIER_MINUTE;
+  for (int t = TIER_COUNT - 1; t > TIER_MINUTE; t--) {
+    if (step >= tierSeconds[t]) {
+      tier = t;
+      break;
+    }
+  }
+  step -= step % tierSeconds[tier];
+  uint32_t bucketsPerStep = step / tierSeconds[tier];
+  
+  uint32_t oldest = (timeSeriesHead[tier] - min(timeSeriesHead[tier], (uint32_t)tierSize[tier] - 1)) * tierSeconds[tier];
+  uint32_t to = server.hasArg("to") ? strtoul(server.arg("to").c_str(), NULL, 10) : now;
+  uint32_t from = server.hasArg("from") ? strtoul(server.arg("from").c_str(), NULL, 10) : oldest;
+  from = max(from, oldest) / step * step;
+  to = min(to, now);
+  
+  uint16_t* buckets = tierBuckets(*series, tier);
+  String points = "";
+  for (uint32_t t = from; t <= to && t >= from; t += step) {
+    uint32_t sum = 0;
+    for (uint32_t k = 0; k < bucketsPerStep; k++) {
+      uint32_t index = t / tierSeconds[tier] + k;
+      if (index <= timeSeriesHead[tier] && timeSeriesHead[tier] - index < (uint32_t)tierSize[tier]) {
+        sum += buckets[index % tierSize[tier]];
+      }
+    }
+    if (points.length() > 0) {
+      points += ",";
+    }
+    points += "[" + String(t) + "," + String(sum) + "]";
+  }
+  
+  String json = "{";
+  json += "\"code\":\"" + jsonEscape(code) + "\",";
+  json += "\"wallClock\":" + String(wallClockValid ? "true" : "false") + ",";
+  json += "\"now\":" + String(now) + ",";
+  json += "\"from\":" + String(from) + ",";
+  json += "\"to\":" + String(to) + ",";
+  json += "\"step\":" + String(step) + ",";
+  json += "\"points\":[" + points + "]";
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+// IRremote protocol for a protocol name, or UNKNOWN
+decode_type_t protocolFromName(const String& name) {
+  static const decode_type_t known[] = {
+    NEC, NEC2, APPLE, ONKYO, SAMSUNG, SAMSUNGLG, SAMSUNG48, SONY, RC5, RC6,
+    KASEIKYO, PANASONIC, JVC, LG, DENON, SHARP
+  };
+  const char* canonical = canonicalProtocol(name);
+  for (size_t i = 0; canonical != NULL && i < sizeof(known) / sizeof(known[0]); i++) {
+    if (strcmp(canonical, getProtocolString(known[i])) == 0) {
+      return known[i];
+    }
+  }
+  return UNKNOWN;
+}
+
+uint32_t ruleHash(decode_type_t protocol, uint16_t address, uint16_t command) {
+  uint32_t hash = ((uint32_t)protocol * 0x9E3779B1u) ^ ((uint32_t)address << 16 | command);
+  hash ^= hash >> 16;
+  hash *= 0x85EBCA6Bu;
+  hash ^= hash >> 13;
+  return hash;
+}
+
+// Slot for a code: the matching slot, or the empty slot where it would be inserted
+RuleSlot* findRuleSlot(decode_type_t protocol, uint16_t address, uint16_t command) {
+  uint32_t index = ruleHash(protocol, address, command) & (RULE_TABLE_SIZE - 1);
+  for (int probe = 0; probe < RULE_TABLE_SIZE; probe++) {
+    RuleSlot& slot = ruleTable[(index + probe) & (RULE_TABLE_SIZE - 1)];
+    if (!slot.used || (slot.protocol == protocol && slot.address == address && slot.command == command)) {
+      return &slot;
+    }
+  }
+  return NULL;
+}
+
+bool isOutputPin(long pin) {
+  // Not GPIO 0/5/12/15 (boot straps), 1/3 (UART0, the serial console), 6-11 (SPI flash),
+  // the status LED or the IR pins
+  return pin >= 2 && pin <= 33 && pin != 3 && pin != 5 && (pin < 6 || pin > 12) && pin != 15 &&
+         pin != LED_PIN && pin != IR_RECEIVE_PIN && pin != IR_TRANSMIT_PIN;
+}
+
+// Parse "PROTOCOL:ADDRESS:COMMAND"
+bool parseIrStep(const String& text, IrStep& step) {
+  int first = text.indexOf(':');
+  int second = first > 0 ? text.indexOf(':', first + 1) : -1;
+  if (second < 0) {
+    return false;
+  }
+  step.protocol = protocolFromName(text.substring(0, first));
+  step.address = strtoul(text.substring(first + 1, second).c_str(), NULL, 0);
+  step.command = strtoul(text.substring(second + 1).c_str(), NULL, 0);
+  return step.protocol != UNKNOWN;
+}
+
+// Compile one rule line; returns an error message or "" on success
+String compileRuleLine(const String& line, Rule& rule, IrStep& trigger) {
+  int arrow = line.indexOf("->");
+  if (arrow < 0) {
+    return "missing '->'";
+  }
+  String condition = line.substring(0, arrow);
+  String action = line.substring(arrow + 2);
+  condition.trim();
+  action.trim();
+  
+  char protocol[24] = "";
+  char address[16] = "";
+  char command[16] = "";
+  int optionsStart = 0;
+  if (sscanf(condition.c_str(), "%23s %15s %15s%n", protocol, address, command, &optionsStart) != 3) {
+    return "expected 'PROTOCOL ADDRESS COMMAND'";
+  }
+  trigger.protocol = protocolFromName(protocol);
+  if (trigger.protocol == UNKNOWN) {
+    return "unknown protocol";
+  }
+  trigger.address = strtoul(address, NULL, 0);
+  trigger.command = strtoul(command, NULL, 0);
+  
+  rule.holdMs = 0;
+  rule.repeatCount = 0;
+  rule.fired = false;
+  
+  // Options after the code: only hold=<ms> and repeat=<n>, so a typo is an error, not a no-op
+  String options = condition.substring(optionsStart);
+  options.trim();
+  while (options.length() > 0) {
+    int space = options.indexOf(' ');
+    String option = space > 0 ? options.substring(0, space) : options;
+    options = space > 0 ? options.substring(space + 1) : "";
+    options.trim();
+    int equals = option.indexOf('=');
+    String value = equals > 0 ? option.substring(equals + 1) : "";
+    char* end;
+    unsigned long number = strtoul(value.c_str(), &end, 10);
+    if (value.length() == 0 || *end != '\0' || !isdigit((unsigned char)value[0])) {
+      return "invalid condition '" + option + "'";
+    }
+    String name = option.substring(0, equals);
+    if (name == "hold" && number <= UINT16_MAX) {
+      rule.holdMs = number;
+    } else if (name == "repeat" && number <= UINT8_MAX) {
+      rule.repeatCount = number;
+    } else if (name == "hold" || name == "repeat") {
+      return "invalid condition '" + option + "'";
+    } else {
+      return "unknown condition '" + option + "'";
+    }
+  }
+  
+  int space = action.indexOf(' ');
+  String type = space > 0 ? action.substring(0, space) : action;
+  String argument = space > 0 ? action.substring(space + 1) : "";
+  argument.trim();
+  if (type == "gpio") {
+    long pin = argument.length() > 0 ? argument.toInt() : -1;
+    if (!isOutputPin(pin)) {
+      return "invalid output pin";
+    }
+    rule.action = ACTION_GPIO;
+    rule.pin = pin;
+  } else if (type == "ir") {
+    rule.action = ACTION_IR;
+    int start = 0;
+    while (start < (int)argument.length()) {
+      int comma = argument.indexOf(',', start);
+      String item = comma < 0 ? argument.substring(start) : argument.substring(start, comma);
+      item.trim();
+      IrStep step;
+      if (!parseIrStep(item, step)) {
+        return "invalid IR step '" + item + "'";
+      }
+      if (rule.steps.size() >= MAX_MACRO_STEPS) {
+        return "too many IR steps";
+      }
+      rule.steps.push_back(step);
+      start = comma < 0 ? argument.length() : comma + 1;
+    }
+    if (rule.steps.empty()) {
+      return "empty IR macro";
+    }
+  } else if (type == "http") {
+    if (!argument.startsWith("http://") || argument.length() >= sizeof(((RuleJob*)0)->text)) {
+      return "expected http:// URL";
+    }
+    rule.action = ACTION_HTTP;
+    rule.text = argument;
+  } else if (type == "mqtt") {
+    int topicEnd = argument.indexOf(' ');
+    String topic = topicEnd > 0 ? argument.substring(0, topicEnd) : argument;
+    if (topic.length() == 0 || topic.length() >= sizeof(((MqttMessage*)0)->topic) ||
+        argument.length() - topic.length() > sizeof(((MqttMessage*)0)->payload)) {
+      return "expected 'mqtt TOPIC [PAYLOAD]'";
+    }
+    rule.action = ACTION_MQTT;
+    rule.text = argument;
+  } else {
+    return "unknown action '" + type + "'";
+  }
+  return "";
+}
+
+// Compile rules text into the dispatch table; on error the current rules stay in place
+String compileRules(const String& text) {
+  std::vector<Rule> compiled;
+  std::vector<IrStep> triggers;
+  int start = 0;
+  int lineNumber = 0;
+  while (start < (int)text.length()) {
+    int end = text.indexOf('\n', start);
+    String line = end < 0 ? text.substring(start) : text.substring(start, end);
+    start = end < 0 ? text.length() : end + 1;
+    lineNumber++;
+    line.trim();
+    if (line.length() == 0 || line.startsWith("#")) {
+      continue;
+    }
+    if (compiled.size() >= MAX_RULES) {
+      return "line " + String(lineNumber) + ": more than " + String(MAX_RULES) + " rules";
+    }
+    Rule rule;
+    IrStep trigger;
+    String error = compileRuleLine(line, rule, trigger);
+    if (error.length() > 0) {
+      return "line " + String(lineNumber) + ": " + error;
+    }
+    compiled.push_back(rule);
+    triggers.push_back(trigger);
+  }
+  
+  memset(ruleTable, 0, sizeof(ruleTable));
+  for (size_t i = 0; i < compiled.size(); i++) {
+    RuleSlot* slot = findRuleSlot(triggers[i].protocol, triggers[i].address, triggers[i].command);
+    if (!slot->used) {
+      slot->used = true;
+      slot->protocol = triggers[i].protocol;
+      slot->address = triggers[i].address;
+      slot->command = triggers[i].command;
+      slot->firstRule = -1;
+    }
+    // Keep rules in file order within a code's chain
+    compiled[i].next = -1;
+    if (slot->firstRule < 0) {
+      slot->firstRule = i;
+    } else {
+      int last = slot->firstRule;
+      while (compiled[last].next >= 0) {
+        last = compiled[last].next;
+      }
+      compiled[last].next = i;
+    }
+    if (compiled[i].action == ACTION_GPIO) {
+      pinMode(compiled[i].pin, OUTPUT);
+    }
+  }
+  rules = compiled;
+  rulesText = text;
+  return "";
+}
+
+void loadRules() {
+  preferences.begin("rules", true);
+  String text = preferences.getString("text", "");
+  preferences.end();
+  String error = compileRules(text);
+  if (error.length() > 0) {
+    Serial.println("❌ Stored rules rejected: " + error);
+  } else {
+    Serial.println("Rules loaded: " + String(rules.size()));
+  }
+}
+
+void fireRule(Rule& rule) {
+  rulesFired++;
+  if (rule.action == ACTION_GPIO) {
+    digitalWrite(rule.pin, !digitalRead(rule.pin));
+    return;
+  }
+  
+  // Slow actions go to the worker task
+  RuleJob job;
+  job.action = rule.action;
+  job.stepCount = rule.steps.size();
+  for (size_t i = 0; i < rule.steps.size(); i++) {
+    job.steps[i] = rule.steps[i];
+  }
+  snprintf(job.text, sizeof(job.text), "%s", rule.text.c_str());
+  if (ruleQueue == NULL || xQueueSend(ruleQueue, &job, 0) != pdTRUE) {
+    ruleJobsDropped++;
+  }
+}
+
+// Evaluate rules for the current frame: one hash probe, then only the rules for this code
+void evaluateRules() {
+  unsigned long startMicros = micros();
+  const IRData& data = IrReceiver.decodedIRData;
+  RuleSlot* slot = rules.empty() ? NULL : findRuleSlot(data.protocol, data.address, data.command);
+  if (slot != NULL && slot->used) {
+    unsigned long now = millis();
+    // Frames closer than NEW_PRESS_GAP_MS belong to the same press, whatever the repeat flag says
+    if (slot->pressFrames == 0 || now - slot->lastFrame > NEW_PRESS_GAP_MS) {
+      slot->pressStart = now;
+      slot->pressFrames = 0;
+      for (int i = slot->firstRule; i >= 0; i = rules[i].next) {
+        rules[i].fired = false;
+      }
+    }
+    slot->lastFrame = now;
+    slot->pressFrames++;
+    
+    for (int i = slot->firstRule; i >= 0; i = rules[i].next) {
+      Rule& rule = rules[i];
+      if (rule.fired || now - slot->pressStart < rule.holdMs || slot->pressFrames < rule.repeatCount) {
+        continue;
+      }
+      rule.fired = true;
+      fireRule(rule);
+    }
+  }
+  uint32_t elapsed = micros() - startMicros;
+  updateRunningStat(ruleEvalMicros, elapsed);
+  ruleEvalMaxMicros = max(ruleEvalMaxMicros, elapsed);
+}
+
+// Rule worker task: IR macros and HTTP callbacks run here, away from the capture loop
+void ruleWorkerTask(void* parameter) {
+  RuleJob job;
+  for (;;) {
+    if (xQueueReceive(ruleQueue, &job, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (job.action == ACTION_IR) {
+      for (uint8_t i = 0; i < job.stepCount; i++) {
+        IrSender.write(job.steps[i].protocol, job.steps[i].address, job.steps[i].command, 0);
+        vTaskDelay(pdMS_TO_TICKS(40));
+      }
+    } else if (job.action == ACTION_HTTP) {
+      if (WiFi.status() != WL_CONNECTED) {
+        continue;
+      }
+      HTTPClient http;
+      http.setTimeout(3000);
+      if (http.begin(job.text)) {
+        int code = http.GET();
+        if (code <= 0) {
+          Serial.println("Rule HTTP callback failed: " + String(job.text));
+        }
+        http.end();
+      }
+    } else if (job.action == ACTION_MQTT) {
+      MqttMessage message;
+      char* space = strchr(job.text, ' ');
+      if (space != NULL) {
+        *space = '\0';
+      }
+      // compileRules() checked both lengths; a message that does not fit is dropped, not cut
+      int topicLength = snprintf(message.topic, sizeof(message.topic), "%s", job.text);
+      int payloadLength = snprintf(message.payload, sizeof(message.payload), "%s", space != NULL ? space + 1 : "");
+      if (topicLength >= (int)sizeof(message.topic) || payloadLength >= (int)sizeof(message.payload) ||
+          mqttMessageQueue == NULL || xQueueSend(mqttMessageQueue, &message, 0) != pdTRUE) {
+        ruleJobsDropped++;
+      }
+    }
+  }
+}
+
+// Handler for rules: GET returns the rules and counters, POST replaces them
+void handleRules() {
+  if (server.method() == HTTP_POST) {
+    String text = server.arg("rules");
+    if (text.length() > MAX_RULES_TEXT) {
+      server.send(200, "application/json", "{\"success\":false,\"message\":\"Rules text too long!\"}");
+      return;
+    }
+    String error = compileRules(text);
+    if (error.length() > 0) {
+      server.send(200, "application/json", "{\"success\":false,\"message\":\"" + jsonEscape(error) + "\"}");
+      return;
+    }
+    preferences.begin("rules", false);
+    preferences.putString("text", text);
+    preferences.end();
+    server.send(200, "application/json", "{\"success\":true,\"message\":\"Rules saved! Total: " + String(rules.size()) + "\"}");
+    return;
+  }
+  
+  String json = "{";
+  json += "\"rules\":\"" + jsonEscape(rulesText) + "\",";
+  json += "\"count\":" + String(rules.size()) + ",";
+  json += "\"fired\":" + String(rulesFired) + ",";
+  json += "\"dropped\":" + String(ruleJobsDropped.load()) + ",";
+  json += "\"evalMicros\":" + runningStatToJson(ruleEvalMicros) + ",";
+  json += "\"evalMaxMicros\":" + String(ruleEvalMaxMicros);
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+// Handler for deleting all rules
+void handleRulesClear() {
+  compileRules("");
+  preferences.begin("rules", false);
+  preferences.clear();
+  preferences.end();
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"All rules deleted!\"}");
+}
+
+// Name of the compiled-in decoder profile
+const char* decoderProfileName() {
+#if defined(DECODER_PROFILE_NEC)
+  return "nec";
+#elif defined(DECODER_PROFILE_TV)
+  return "tv";
+#else
+  return "all";
+#endif
+}
+
+// Try decoders with the most frequent protocol first; catch-all decoders keep their place at the end.
+// Halving the weights afterwards makes the order follow roughly the last 64 decodes, so a new
+// remote overtakes one that was used for months.
+void reorderDecoders() {
+  std::stable_sort(decoderOrder, decoderOrder + DECODER_COUNT, [](uint8_t a, uint8_t b) {
+    if (decoders[a].pinned != decoders[b].pinned) {
+      return !decoders[a].pinned;
+    }
+    return !decoders[a].pinned && decoders[a].recentHits > decoders[b].recentHits;
+  });
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    decoders[i].recentHits /= 2;
+  }
+  decodesSinceReorder = 0;
+}
+
+// Enable mask for a comma separated list of decoder names; names not built into this profile are skipped
+uint32_t decoderMaskFromNames(String names) {
+  names = "," + names + ",";
+  names.replace(" ", "");
+  uint32_t mask = 0;
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    if (names.indexOf("," + String(decoders[i].name) + ",") >= 0) {
+      mask |= bit(i);
+    }
+  }
+  return mask;
+}
+
+void loadDecoderProfile() {
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    decoderOrder[i] = i;
+  }
+  // Saved as names because decoders[] differs between build profiles; none saved enables all
+  preferences.begin("decoders", true);
+  String saved = preferences.getString("enabled", "");
+  preferences.end();
+  decoderMask = saved.length() > 0 ? decoderMaskFromNames(saved) : 0xFFFFFFFF;
+  if (decoderMask == 0) {
+    Serial.println("⚠️ No saved decoder is built into this profile, enabling all");
+    decoderMask = 0xFFFFFFFF;
+  }
+  
+  String enabled = "";
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    if (decoderMask & bit(i)) {
+      enabled += String(enabled.length() > 0 ? ", " : "") + decoders[i].name;
+    }
+  }
+  Serial.println("Decoder profile: " + String(decoderProfileName()) + " | enabled: " + enabled);
+}
+
+// Replacement for IrReceiver.decode(): only enabled decoders, in priority order, each one timed
+bool decodeWithProfile() {
+  if (!IrReceiver.available()) {
+    return false;
+  }
+  unsigned long startMicros = micros();
+  IrReceiver.initDecodedIRData();
+  if (IrReceiver.decodedIRData.flags & IRDATA_FLAGS_WAS_OVERFLOW) {
+    return true;
+  }
+  
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    DecoderEntry& decoder = decoders[decoderOrder[i]];
+    if (!(decoderMask & bit(decoderOrder[i]))) {
+      continue;
+    }
+    unsigned long attemptMicros = micros();
+    bool decoded = (IrReceiver.*decoder.decode)();
+    decoder.micros += micros() - attemptMicros;
+    decoder.attempts++;
+    if (decoded) {
+      decoder.hits++;
+      decoder.recentHits++;
+      // Leader mark shortfall, which is what a slow wakeup from light sleep costs
+      if (decoder.headerMarkMicros > 0) {
+        uint32_t leader = (uint32_t)IrReceiver.decodedIRData.rawDataPtr->rawbuf[1] * MICROS_PER_TICK;
+        uint32_t loss = leader < decoder.headerMarkMicros ? decoder.headerMarkMicros - leader : 0;
+        updateRunningStat(leaderLossMicros, loss);
+        maxLeaderLossMicros = max(maxLeaderLossMicros, loss);
+      }
+      if (++decodesSinceReorder >= DECODER_REORDER_INTERVAL) {
+        reorderDecoders();
+      }
+      break;
+    }
+  }
+  
+  // A frame no decoder accepted stays UNKNOWN, as with IrReceiver.decode()
+  updateRunningStat(decodeMicros, micros() - startMicros);
+  return true;
+}
+
+// Light sleep stops IRremote's 50 us timer until the chip is awake again, which eats into the leader
+// mark. An enabled decoder with a leader too short for that keeps the chip out of light sleep.
+bool shortLeaderDecoderEnabled() {
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    if ((decoderMask & bit(i)) && !decoders[i].pinned && decoders[i].headerMarkMicros < LIGHT_SLEEP_MIN_HEADER_US) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Hold or drop the no-light-sleep lock after the enabled decoders changed
+void updateLightSleepGate() {
+#if defined(IDLE_LIGHT_SLEEP)
+  bool block = shortLeaderDecoderEnabled();
+  if (lightSleepLock == NULL || block == lightSleepBlocked) {
+    return;
+  }
+  if (block) {
+    esp_pm_lock_acquire(lightSleepLock);
+  } else {
+    esp_pm_lock_release(lightSleepLock);
+  }
+  lightSleepBlocked = block;
+  Serial.println(block ? "Light sleep blocked: a short-leader decoder is enabled" : "Light sleep allowed");
+#endif
+}
+
+// Handler for decoder profile: GET returns order and cost counters, POST sets the enabled decoders
+void handleDecoders() {
+  if (server.method() == HTTP_POST) {
+    // "enabled" is a comma separated list of decoder names; empty enables all
+    String list = server.arg("enabled");
+    list.replace(" ", "");
+    uint32_t mask = list.length() > 0 ? decoderMaskFromNames(list) : 0xFFFFFFFF;
+    if (mask == 0) {
+      server.send(200, "application/json", "{\"success\":false,\"message\":\"No known decoder in the list!\"}");
+      return;
+    }
+    decoderMask = mask;
+    String names = "";
+    for (int i = 0; list.length() > 0 && i < DECODER_COUNT; i++) {
+      if (decoderMask & bit(i)) {
+        names += String(names.length() > 0 ? "," : "") + decoders[i].name;
+      }
+    }
+    preferences.begin("decoders", false);
+    preferences.remove("mask");
+    if (names.length() > 0) {
+      preferences.putString("enabled", names);
+    } else {
+      preferences.remove("enabled");
+    }
+    preferences.end();
+    updateLightSleepGate();
+    server.send(200, "application/json", "{\"success\":true,\"message\":\"Decoder profile saved!\"}");
+    return;
+  }
+  
+  String json = "{";
+  json += "\"profile\":\"" + String(decoderProfileName()) + "\",";
+  json += "\"decodeMicros\":" + runningStatToJson(decodeMicros) + ",";
+  json += "\"decoders\":[";
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    const DecoderEntry& decoder = decoders[decoderOrder[i]];
+    if (i > 0) {
+      json += ",";
+    }
+    json += "{\"name\":\"" + String(decoder.name) + "\",";
+    json += "\"enabled\":" + String(decoderMask & bit(decoderOrder[i]) ? "true" : "false") + ",";
+    json += "\"position\":" + String(i) + ",";
+    json += "\"attempts\":" + String(decoder.attempts) + ",";
+    json += "\"hits\":" + String(decoder.hits) + ",";
+    json += "\"totalMicros\":" + String((unsigned long)decoder.micros) + ",";
+    json += "\"avgMicros\":" + String(decoder.attempts > 0 ? (float)decoder.micros / decoder.attempts : 0.0f, 1) + "}";
+  }
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+// Called by the heap allocator when an allocation fails
+void onAllocFailed(size_t size, uint32_t caps, const char* functionName) {
+  failedAllocs++;
+  if (size > largestFailedAlloc) {
+    largestFailedAlloc = size;
+  }
+}
+
+// Record one heap sample; warns once when the largest free block drops below the threshold
+void takeHeapSample() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  HeapSample& sample = heapSamples[(heapSampleHead + heapSampleCount) % HEAP_SAMPLES];
+  if (heapSampleCount < HEAP_SAMPLES) {
+    heapSampleCount++;
+  } else {
+    heapSampleHead = (heapSampleHead + 1) % HEAP_SAMPLES;
+  }
+  sample.uptimeSeconds = uptimeMillis() / 1000;
+  sample.freeBytes = info.total_free_bytes;
+  sample.largestBlock = info.largest_free_block;
+  sample.allocatedBlocks = info.allocated_blocks;
+  
+  if (info.largest_free_block < HEAP_LARGEST_BLOCK_WARN && lowestLargestBlock >= HEAP_LARGEST_BLOCK_WARN) {
+    Serial.println("⚠️ Heap fragmented: largest free block " + String((unsigned long)info.largest_free_block) + " bytes");
+  }
+  lowestLargestBlock = min(lowestLargestBlock, (uint32_t)info.largest_free_block);
+  lastHeapSample = millis();
+}
+
+void serviceHeapMonitor() {
+  if (millis() - lastHeapSample >= HEAP_SAMPLE_MS) {
+    takeHeapSample();
+  }
+}
+
+// Handler for heap health (JSON)
+void handleHeap() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  lowestLargestBlock = min(lowestLargestBlock, (uint32_t)info.largest_free_block);
+  
+  String json;
+  json.reserve(256 + heapSampleCount * 40);
+  json = "{";
+  json += "\"freeHeap\":" + String((unsigned long)info.total_free_bytes) + ",";
+  json += "\"minFreeHeap\":" + String((unsigned long)info.minimum_free_bytes) + ",";
+  json += "\"largestFreeBlock\":" + String((unsigned long)info.largest_free_block) + ",";
+  json += "\"lowestLargestFreeBlock\":" + String(lowestLargestBlock) + ",";
+  json += "\"fragmentation\":" + String(info.total_free_bytes > 0 ? 1.0f - (float)info.largest_free_block / info.total_free_bytes : 0.0f, 3) + ",";
+  json += "\"allocatedBlocks\":" + String((unsigned long)info.allocated_blocks) + ",";
+  json += "\"freeBlocks\":" + String((unsigned long)info.free_blocks) + ",";
+  json += "\"failedAllocs\":" + String(failedAllocs) + ",";
+  json += "\"largestFailedAlloc\":" + String(largestFailedAlloc) + ",";
+  json += "\"uptime\":" + String((unsigned long)(uptimeMillis() / 1000)) + ",";
+  json += "\"samples\":[";
+  for (int i = 0; i < heapSampleCount; i++) {
+    const HeapSample& sample = heapSamples[(heapSampleHead + i) % HEAP_SAMPLES];
+    if (i > 0) {
+      json += ",";
+    }
+    json += "[" + String(sample.uptimeSeconds) + "," + String(sample.freeBytes) + "," +
+            String(sample.largestBlock) + "," + String(sample.allocatedBlocks) + "]";
+  }
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+// First falling edge of a frame on the receiver pin; wakes loop() once per frame
+void IRAM_ATTR onIrEdge() {
+  if (irEdgePending) {
+    return;
+  }
+  irEdgeMicros = micros();
+  irEdgePending = true;
+#if defined(IDLE_LIGHT_SLEEP)
+  // The wakeup source makes this a level interrupt: mask it and stay awake until the frame is done
+  gpio_intr_disable((gpio_num_t)IR_RECEIVE_PIN);
+  if (lightSleepLock != NULL) {
+    esp_pm_lock_acquire(lightSleepLock);
+    frameHoldsLightSleepLock = true;
+  }
+#endif
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loopTaskHandle, &woken);
+  if (woken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+// How long loop() may block before it has work to do. Pure (the clock is passed in) so the
+// schedule can be replayed against a simulated clock.
+uint32_t loopWaitBudget(unsigned long now, unsigned long lastHttp, bool framePending, bool ledLit,
+                        unsigned long ledOffTime) {
+  uint32_t budget = now - lastHttp < HTTP_ACTIVE_WINDOW_MS ? HTTP_ACTIVE_POLL_MS : HTTP_IDLE_POLL_MS;
+  if (framePending) {
+    budget = min(budget, FRAME_POLL_MS);
+  }
+  if (ledLit) {
+    long untilLedOff = (long)(ledOffTime - now);
+    budget = min(budget, untilLedOff > 0 ? (uint32_t)untilLedOff : 0);
+  }
+  return budget;
+}
+
+// Automatic light sleep, station mode only: an access point cannot sleep its radio. The framework
+// must be built with CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE.
+void configureLightSleep() {
+#if defined(IDLE_LIGHT_SLEEP)
+  if (WiFi.getMode() != WIFI_STA) {
+    Serial.println("Light sleep off: access point mode");
+    return;
+  }
+  // Modem sleep keeps the association, waking the radio for DTIM beacons
+  WiFi.setSleep(true);
+  gpio_wakeup_enable((gpio_num_t)IR_RECEIVE_PIN, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  esp_pm_config_esp32_t config = {};
+  config.max_freq_mhz = 240;
+  config.min_freq_mhz = 80;
+  config.light_sleep_enable = true;
+  esp_err_t result = esp_pm_configure(&config);
+  if (result != ESP_OK) {
+    Serial.println("❌ Light sleep not supported by this framework build (error " + String(result) + ")");
+    return;
+  }
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "ir", &lightSleepLock);
+  updateLightSleepGate();
+  Serial.println("Light sleep on: idle waits sleep, receiver pin wakes");
+#endif
+}
+
+// Block for up to waitMs, returning early on an IR edge; the idle task light-sleeps meanwhile
+void waitForWork(uint32_t waitMs) {
+  unsigned long start = micros();
+  bool irWake = waitMs > 0 && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs)) > 0;
+  blockedMicros += micros() - start;
+  loopWakeups++;
+  if (irWake) {
+    irWakeups++;
+  } else {
+    timerWakeups++;
+  }
+}
+
+// The frame that raised irEdgePending was decoded or timed out: re-arm the edge interrupt
+void endIrFrame() {
+  irEdgePending = false;
+#if defined(IDLE_LIGHT_SLEEP)
+  if (frameHoldsLightSleepLock) {
+    frameHoldsLightSleepLock = false;
+    esp_pm_lock_release(lightSleepLock);
+  }
+  gpio_intr_enable((gpio_num_t)IR_RECEIVE_PIN);
+#endif
+}
+
+// Account a decoded frame against the edge that woke the loop
+void recordWakeToDecode() {
+  if (!irEdgePending) {
+    return;
+  }
+  uint32_t latency = micros() - irEdgeMicros;
+  updateRunningStat(wakeToDecodeMicros, latency);
+  maxWakeToDecodeMicros = max(maxWakeToDecodeMicros, latency);
+  endIrFrame();
+}
+
+// Handler for main loop wakeup and sleep counters (JSON)
+void handlePower() {
+  uint64_t uptime = uptimeMillis();
+  String json = "{";
+#if defined(IDLE_LIGHT_SLEEP)
+  json += "\"mode\":\"light-sleep\",";
+#else
+  json += "\"mode\":\"notify\",";
+#endif
+  const char* lightSleep = lightSleepLock == NULL ? "off" : lightSleepBlocked ? "blocked" : "on";
+  json += "\"lightSleep\":\"" + String(lightSleep) + "\",";
+  json += "\"uptime\":" + String((unsigned long)(uptime / 1000)) + ",";
+  json += "\"wakeups\":" + String(loopWakeups) + ",";
+  json += "\"irWakeups\":" + String(irWakeups) + ",";
+  json += "\"timerWakeups\":" + String(timerWakeups) + ",";
+  json += "\"wakeupsPerSecond\":" + String(uptime > 0 ? loopWakeups * 1000.0f / uptime : 0.0f, 1) + ",";
+  json += "\"blockedMs\":" + String((unsigned long)(blockedMicros / 1000)) + ",";
+  json += "\"idlePercent\":" + String(uptime > 0 ? blockedMicros / 10.0f / uptime : 0.0f, 1) + ",";
+  json += "\"frames\":" + String(signalCount) + ",";
+  json += "\"overflows\":" + String(deviceStats.overflows) + ",";
+  json += "\"edgesWithoutFrame\":" + String(edgesWithoutFrame) + ",";
+  json += "\"wakeToDecodeMs\":" + runningStatToJson(wakeToDecodeMicros, 1000) + ",";
+  json += "\"maxWakeToDecodeMs\":" + String(maxWakeToDecodeMicros / 1000.0, 1) + ",";
+  json += "\"leaderLossMicros\":" + runningStatToJson(leaderLossMicros) + ",";
+  json += "\"maxLeaderLossMicros\":" + String(maxLeaderLossMicros);
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+const char* resetReasonName(esp_reset_reason_t reason) {
+  switch (reason) {
+    case ESP_RST_POWERON: return "power-on";
+    case ESP_RST_EXT: return "external";
+    case ESP_RST_SW: return "software";
+    case ESP_RST_PANIC: return "panic";
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT: return "watchdog";
+    case ESP_RST_DEEPSLEEP: return "deep-sleep";
+    case ESP_RST_BROWNOUT: return "brownout";
+    default: return "other";
+  }
+}
+
+// Sequence number of the newest event in the history file, false if there is none
+bool lastFlushedSeq(uint32_t& seq) {
+  if (!flashMounted || !LittleFS.exists(HISTORY_FILE)) {
+    return false;
+  }
+  File file = LittleFS.open(HISTORY_FILE, FILE_READ);
+  size_t records = file.size() / sizeof(HistoryEvent);
+  HistoryEvent event;
+  bool found = records > 0 && file.seek((records - 1) * sizeof(HistoryEvent)) &&
+               file.read((uint8_t*)&event, sizeof(event)) == sizeof(event);
+  file.close();
+  if (found) {
+    seq = event.seq;
+  }
+  return found;
+}
+
+// Validate the RTC history after a warm reset and merge it back; start it fresh otherwise
+void restoreRtcHistory() {
+  bootResetReason = esp_reset_reason();
+  uint32_t fileSeq = 0;
+  bool haveFileSeq = lastFlushedSeq(fileSeq);
+  
+  bool valid = bootResetReason != ESP_RST_POWERON && bootResetReason != ESP_RST_UNKNOWN &&
+               rtcHistory.magic == RTC_HISTORY_MAGIC && rtcHistory.version == RTC_HISTORY_VERSION &&
+               rtcHistory.size == sizeof(RtcHistory) && rtcHistory.checksum == rtcHistoryChecksum() &&
+               rtcHistory.commandCount <= MAX_SAVED_COMMANDS &&
+               rtcHistory.commandsChecksum == rtcCommandsChecksum();
+  // A reset while a frame is recorded tears the newest slot: keep the events before the first
+  // bad slot. A bad slot that is already on flash was not torn by a reset, so nothing is trusted.
+  uint32_t oldest = rtcHistory.nextSeq > RTC_HISTORY_EVENTS ? rtcHistory.nextSeq - RTC_HISTORY_EVENTS : 0;
+  uint32_t goodSeq = oldest;
+  // Leading slots not holding their own sequence number (fresh, or left by a truncation) are not in the ring
+  while (goodSeq < rtcHistory.nextSeq && rtcHistory.events[goodSeq % RTC_HISTORY_EVENTS].seq != goodSeq) {
+    goodSeq++;
+  }
+  while (valid && goodSeq < rtcHistory.nextSeq &&
+         rtcHistory.eventChecksums[goodSeq % RTC_HISTORY_EVENTS] == rtcEventChecksum(goodSeq)) {
+    goodSeq++;
+  }
+  uint32_t onFlashSeq = rtcHistory.flushedSeq;
+  if (haveFileSeq && fileSeq >= onFlashSeq && fileSeq < rtcHistory.nextSeq) {
+    onFlashSeq = fileSeq + 1;
+  }
+  valid = valid && goodSeq >= onFlashSeq;
+  if (!valid) {
+    memset(&rtcHistory, 0, sizeof(rtcHistory));
+    rtcHistory.magic = RTC_HISTORY_MAGIC;
+    rtcHistory.version = RTC_HISTORY_VERSION;
+    rtcHistory.size = sizeof(RtcHistory);
+    // Sequence numbers keep increasing across power loss so the history file stays ordered
+    rtcHistory.nextSeq = haveFileSeq ? fileSeq + 1 : 0;
+    rtcHistory.flushedSeq = rtcHistory.nextSeq;
+    rtcHistory.nextCommandId = nextCommandId;
+    for (uint32_t seq = 0; seq < RTC_HISTORY_EVENTS; seq++) {
+      rtcHistory.eventChecksums[seq] = rtcEventChecksum(seq);
+    }
+    rtcHistory.commandsChecksum = rtcCommandsChecksum();
+    sealRtcHistory();
+    Serial.println("RTC history started fresh (" + String(resetReasonName(bootResetReason)) + " reset)");
+    return;
+  }
+  
+  if (goodSeq < rtcHistory.nextSeq) {
+    Serial.println("RTC history: " + String(rtcHistory.nextSeq - goodSeq) + " torn events dropped");
+    historyDropped += rtcHistory.nextSeq - goodSeq;
+    // The ring does not reach back further than before, only its newest slots are gone
+    if (rtcHistory.flushedSeq < oldest) {
+      historyDropped += oldest - rtcHistory.flushedSeq;
+      rtcHistory.flushedSeq = oldest;
+    }
+    rtcHistory.nextSeq = goodSeq;
+    sealRtcHistory();
+  }
+  historyRestored = true;
+  signalCount = rtcHistory.signalCount;
+  if (rtcHistory.nextSeq > 0) {
+    lastEvent = rtcHistory.events[(rtcHistory.nextSeq - 1) % RTC_HISTORY_EVENTS];
+    setLastSignal(lastEvent);
+  }
+  
+  // addSavedCommand re-snapshots as it goes, rewriting each slot with identical contents
+  uint32_t count = rtcHistory.commandCount;
+  uint32_t savedNextId = rtcHistory.nextCommandId;
+  for (uint32_t i = 0; i < count; i++) {
+    const HistoryCommand& slot = rtcHistory.commands[i];
+    IRCommand cmd;
+    char text[192];
+    cmd.protocol = getProtocolString((decode_type_t)slot.frame.protocol);
+    snprintf(text, sizeof(text), "0x%x", slot.frame.address);
+    cmd.address = text;
+    snprintf(text, sizeof(text), "0x%x", slot.frame.command);
+    cmd.command = text;
+    formatRawData(text, sizeof(text), slot.frame);
+    cmd.rawData = text;
+    cmd.timestamp = String(slot.timestamp) + "s";
+    cmd.label = String(slot.label);
+    cmd.frame = slot.frame;
+    nextCommandId = slot.id;
+    addSavedCommand(cmd);
+  }
+  nextCommandId = max(nextCommandId, savedNextId);
+  
+  // A reset between a file append and the flushedSeq update must not write those events twice
+  if (haveFileSeq && fileSeq >= rtcHistory.flushedSeq && fileSeq < rtcHistory.nextSeq) {
+    rtcHistory.flushedSeq = fileSeq + 1;
+  }
+  snapshotSavedCommands();
+  Serial.println("♻️ Restored after " + String(resetReasonName(bootResetReason)) + " reset: " +
+                 String(signalCount) + " signals, " + String(savedCommands.size()) + " saved commands, " +
+                 String(rtcHistory.nextSeq - rtcHistory.flushedSeq) + " events to flush");
+}
+
+// Add the current frame to the RTC ring; no flash access here
+void recordHistoryEvent() {
+  lastEvent.seq = rtcHistory.nextSeq++;
+  rtcHistory.events[lastEvent.seq % RTC_HISTORY_EVENTS] = lastEvent;
+  rtcHistory.eventChecksums[lastEvent.seq % RTC_HISTORY_EVENTS] = rtcEventChecksum(lastEvent.seq);
+  rtcHistory.signalCount = signalCount;
+  sealRtcHistory();
+}
+
+// Append the unflushed events to the history file in one write burst
+void flushHistory() {
+  uint32_t oldest = rtcHistory.nextSeq > RTC_HISTORY_EVENTS ? rtcHistory.nextSeq - RTC_HISTORY_EVENTS : 0;
+  if (rtcHistory.flushedSeq < oldest) {
+    historyDropped += oldest - rtcHistory.flushedSeq;
+    rtcHistory.flushedSeq = oldest;
+  }
+  
+  if (LittleFS.exists(HISTORY_FILE)) {
+    File file = LittleFS.open(HISTORY_FILE, FILE_READ);
+    bool full = file.size() >= HISTORY_FILE_MAX_EVENTS * sizeof(HistoryEvent);
+    file.close();
+    if (full) {
+      LittleFS.remove(HISTORY_OLD_FILE);
+      LittleFS.rename(HISTORY_FILE, HISTORY_OLD_FILE);
+    }
+  }
+  
+  File file = LittleFS.open(HISTORY_FILE, FILE_APPEND);
+  if (file) {
+    for (uint32_t seq = rtcHistory.flushedSeq; seq < rtcHistory.nextSeq; seq++) {
+      file.write((const uint8_t*)&rtcHistory.events[seq % RTC_HISTORY_EVENTS], sizeof(HistoryEvent));
+    }
+    file.close();
+    rtcHistory.flushedSeq = rtcHistory.nextSeq;
+  }
+  sealRtcHistory();
+  lastHistoryFlush = millis();
+}
+
+// Flush once a batch has collected, or when events have waited long enough
+void serviceHistory() {
+  uint32_t pending = rtcHistory.nextSeq - rtcHistory.flushedSeq;
+  if (!flashMounted || pending == 0) {
+    return;
+  }
+  if (pending >= HISTORY_FLUSH_BATCH || millis() - lastHistoryFlush >= HISTORY_FLUSH_MS) {
+    flushHistory();
+  }
+}
+
+String historyEventToJson(const HistoryEvent& event) {
+  char raw[20];
+  snprintf(raw, sizeof(raw), "0x%llx", (unsigned long long)event.rawData);
+  String json = "{\"seq\":" + String(event.seq) + ",";
+  json += "\"time\":" + String(event.time) + ",";
+  json += "\"protocol\":\"" + String(getProtocolString((decode_type_t)event.protocol)) + "\",";
+  json += "\"address\":\"0x" + String(event.address, HEX) + "\",";
+  json += "\"command\":\"0x" + String(event.command, HEX) + "\",";
+  json += "\"flags\":" + String(event.flags) + ",";
+  json += "\"raw\":\"" + String(raw) + "\",";
+  json += "\"bits\":" + String(event.bits) + "}";
+  return json;
+}
+
+// Handler for recent events, newest first: /history?limit=
+void handleHistory() {
+  long limit = server.hasArg("limit") ? server.arg("limit").toInt() : HISTORY_DEFAULT_LIMIT;
+  if (limit <= 0 || limit > HISTORY_MAX_LIMIT) {
+    limit = HISTORY_MAX_LIMIT;
+  }
+  
+  String json = "{";
+  json += "\"resetReason\":\"" + String(resetReasonName(bootResetReason)) + "\",";
+  json += "\"restored\":" + String(historyRestored ? "true" : "false") + ",";
+  json += "\"signalCount\":" + String(signalCount) + ",";
+  json += "\"pending\":" + String(rtcHistory.nextSeq - rtcHistory.flushedSeq) + ",";
+  json += "\"dropped\":" + String(historyDropped) + ",";
+  json += "\"events\":[";
+  
+  // The RTC ring holds the newest events (including all unflushed ones), the file the older ones
+  int emitted = 0;
+  uint32_t listedFrom = rtcHistory.nextSeq;
+  uint32_t oldest = rtcHistory.nextSeq > RTC_HISTORY_EVENTS ? rtcHistory.nextSeq - RTC_HISTORY_EVENTS : 0;
+  while (emitted < limit && listedFrom > oldest &&
+         rtcHistory.events[(listedFrom - 1) % RTC_HISTORY_EVENTS].seq == listedFrom - 1) {
+    listedFrom--;
+    json += (emitted++ > 0 ? "," : "") + historyEventToJson(rtcHistory.events[listedFrom % RTC_HISTORY_EVENTS]);
+  }
+  if (emitted < limit && flashMounted && LittleFS.exists(HISTORY_FILE)) {
+    File file = LittleFS.open(HISTORY_FILE, FILE_READ);
+    for (size_t i = file.size() / sizeof(HistoryEvent); i > 0 && emitted < limit; i--) {
+      HistoryEvent event;
+      file.seek((i - 1) * sizeof(HistoryEvent));
+      if (file.read((uint8_t*)&event, sizeof(event)) != sizeof(event) || event.seq >= listedFrom) {
+        continue;
+      }
+      json += (emitted++ > 0 ? "," : "") + historyEventToJson(event);
+    }
+    file.close();
+  }
+  
+  json += "]}";
+  server.send(200, "application/json", json);
+}
+
+// Functions for managing WiFi config in Preferences
+void saveWiFiCredentials(String ssid, String password) {
+  preferences.begin("wifi", false);
+  preferences.putString("ssid", ssid);
+  preferences.putString("password", password);
+  preferences.putBool("configured", true);
+  preferences.end();
+  Serial.println("WiFi credentials saved to EEPROM");
+}
+
+void loadWiFiCredentials() {
+  preferences.begin("wifi", true);
+  wifiConfigured = preferences.getBool("configured", false);
+  if (wifiConfigured) {
+    wifi_ssid = preferences.getString("ssid", "");
+    wifi_password = preferences.getString("password", "");
+    Serial.println("WiFi credentials loaded from EEPROM");
+    Serial.println("SSID: " + wifi_ssid);
+  }
+  preferences.end();
+}
+
+void clearWiFiCredentials() {
+  preferences.begin("wifi", false);
+  preferences.clear();
+  preferences.end();
+  wifiConfigured = false;
+  wifiConnected = false;
+  wifi_ssid = "";
+  wifi_password = "";
+  Serial.println("WiFi credentials erased from EEPROM");
+}
+
+// Handler for WiFi status
+void handleWiFiStatus() {
+  String json = "{";
+  json += "\"connected\":" + String(wifiConnected ? "true" : "false") + ",";
+  json += "\"ssid\":\"" + (wifiConnected ? WiFi.SSID() : String(ap_ssid)) + "\",";
+  json += "\"ip\":\"" + (wifiConnected ? WiFi.localIP().toString() : WiFi.softAPIP().toString()) + "\",";
+  json += "\"saved_ssid\":\"" + wifi_ssid + "\"";
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+// Handler for saving WiFi configuration
+void handleWiFiConfig() {
+  if (server.method() != HTTP_POST) {
+    server.send(405, "text/plain", "Method Not Allowed");
+    return;
+  }
+  
+  String ssid = server.arg("ssid");
+  String password = server.arg("password");
+  
+  if (ssid.length() == 0) {
+    server.send(200, "application/json", "{\"success\":false,\"message\":\"Invalid SSID!\"}");
+    return;
+  }
+  
+  // Save credentials
+  saveWiFiCredentials(ssid, password);
+  
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"Configuration saved! ESP32 will restart...\"}");
+  
+  // Restart ESP32 after 3 seconds
+  delay(3000);
+  ESP.restart();
+}
+
+// Handler for clearing WiFi configuration
+void handleWiFiClear() {
+  clearWiFiCredentials();
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"WiFi configuration cleared!\"}");
+}
+
+// Function for connecting to WiFi
+bool connectToWiFi() {
+  if (!wifiConfigured || wifi_ssid.length() == 0) {
+    return false;
+  }
+  
+  Serial.println("\nAttempting to connect to WiFi: " + wifi_ssid);
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(wifi_ssid.c_str(), wifi_password.c_str());
+  
+  int attempts = 0;
+  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
+    delay(500);
+    Serial.print(".");
+    attempts++;
+  }
+  
+  if (WiFi.status() == WL_CONNECTED) {
+    wifiConnected = true;
+    Serial.println("\n✅ Connected to WiFi!");
+    Serial.print("IP Address: ");
+    Serial.println(WiFi.localIP());
+    return true;
+  } else {
+    Serial.println("\n❌ Could not connect to WiFi");
+    return false;
+  }
+}
+
+// Function for starting Access Point
+void startAccessPoint() {
+  Serial.println("\nStarting Access Point...");
+  WiFi.mode(WIFI_AP);
+  WiFi.softAP(ap_ssid, ap_password);
+  
+  IPAddress IP = WiFi.softAPIP();
+  Serial.print("Access Point created! SSID: ");
+  Serial.println(ap_ssid);
+  Serial.print("Password: ");
   Serial.println(ap_password);
   Serial.print("IP Address: ");
   Serial.println(IP);
 }
 
+// Functions for managing MQTT config in Preferences
+void saveMqttConfig(String host, uint16_t port, String user, String password, String topic) {
+  preferences.begin("mqtt", false);
+  preferences.putString("host", host);
+  preferences.putUShort("port", port);
+  preferences.putString("user", user);
+  preferences.putString("password", password);
+  preferences.putString("topic", topic);
+  preferences.end();
+  Serial.println("MQTT configuration saved to EEPROM");
+}
+
+void loadMqttConfig() {
+  preferences.begin("mqtt", true);
+  String host = preferences.getString("host", "");
+  uint16_t port = preferences.getUShort("port", 1883);
+  String user = preferences.getString("user", "");
+  String password = preferences.getString("password", "");
+  String topic = preferences.getString("topic", "esp32ir");
+  preferences.end();
+  
+  // The publisher task copies these in applyMqttConfig(); swap them in while it cannot
+  xSemaphoreTake(mqttConfigMutex, portMAX_DELAY);
+  mqtt_host = host;
+  mqtt_port = port;
+  mqtt_user = user;
+  mqtt_password = password;
+  mqtt_topic = topic;
+  xSemaphoreGive(mqttConfigMutex);
+  mqttConfigured = mqtt_host.length() > 0;
+  if (mqttConfigured) {
+    Serial.println("MQTT broker: " + mqtt_host + ":" + String(mqtt_port) + " topic: " + mqtt_topic);
+  }
+}
+
+// Look up the label of a saved command (empty if the code was never labelled). RAM only: the
+// library, which lives on flash, is consulted later by the MQTT task.
+String findCommandLabel(const String& protocol, const String& address, const String& command) {
+  std::map<String, std::vector<uint32_t>>::iterator entry = addressIndex.find(address);
+  for (size_t i = 0; entry != addressIndex.end() && i < entry->second.size(); i++) {
+    int pos = findCommandPosition(entry->second[i]);
+    if (pos >= 0 && savedCommands[pos].label.length() > 0 &&
+        savedCommands[pos].command == command && savedCommands[pos].protocol == protocol) {
+      return savedCommands[pos].label;
+    }
+  }
+  return "";
+}
+
+// Copy a string into a fixed event field, replacing characters that would break the JSON payload
+void copyEventField(char* dest, size_t size, const String& value) {
+  size_t i = 0;
+  for (; i + 1 < size && i < value.length(); i++) {
+    char c = value[i];
+    dest[i] = (c == '"' || c == '\\' || c < 0x20) ? '_' : c;
+  }
+  dest[i] = '\0';
+}
+
+// Hand the last received signal to the MQTT publisher (never blocks the capture path)
+void queueMqttEvent() {
+  if (mqttQueue == NULL || !mqttConfigured) {
+    return;
+  }
+  IREvent event;
+  event.sequence = signalCount;
+  event.timestampMs = lastReceiveTime;
+  event.address = IrReceiver.decodedIRData.address;
+  event.command = IrReceiver.decodedIRData.command;
+  copyEventField(event.protocol, sizeof(event.protocol), lastProtocol);
+  copyEventField(event.label, sizeof(event.label), findCommandLabel(lastProtocol, lastAddress, lastCommand));
+  if (xQueueSend(mqttQueue, &event, 0) != pdTRUE) {
+    mqttDropped++;
+  }
+}
+
+// MQTT publisher task: everything below runs on core 0, away from the capture path
+char mqttHostBuf[64];
+char mqttUserBuf[32];
+char mqttPasswordBuf[64];
+char mqttEventsTopic[80];
+char mqttStatusTopic[80];
+char mqttClientId[32];
+char mqttPayload[MQTT_MAX_BATCH * 160 + 64];
+
+// Copy the current configuration into the buffers PubSubClient keeps pointers to
+void applyMqttConfig() {
+  xSemaphoreTake(mqttConfigMutex, portMAX_DELAY);
+  snprintf(mqttHostBuf, sizeof(mqttHostBuf), "%s", mqtt_host.c_str());
+  snprintf(mqttUserBuf, sizeof(mqttUserBuf), "%s", mqtt_user.c_str());
+  snprintf(mqttPasswordBuf, sizeof(mqttPasswordBuf), "%s", mqtt_password.c_str());
+  snprintf(mqttEventsTopic, sizeof(mqttEventsTopic), "%s/events", mqtt_topic.c_str());
+  snprintf(mqttStatusTopic, sizeof(mqttStatusTopic), "%s/status", mqtt_topic.c_str());
+  uint16_t port = mqtt_port;
+  xSemaphoreGive(mqttConfigMutex);
+  snprintf(mqttClientId, sizeof(mqttClientId), "esp32ir-%06llx", (unsigned long long)(ESP.getEfuseMac() & 0xFFFFFF));
+  mqttClient.setServer(mqttHostBuf, port);
+}
+
+// Append events to the flash spool once the RAM buffer is full
+void spoolMqttEvents(const IREvent* events, int count) {
+  size_t bytes = count * sizeof(IREvent);
+  if (!flashMounted || mqttSpoolSize + bytes > MQTT_SPOOL_MAX_BYTES) {
+    mqttDropped += count;
+    return;
+  }
+  File file = LittleFS.open(MQTT_SPOOL_FILE, FILE_APPEND);
+  if (!file) {
+    mqttDropped += count;
+    return;
+  }
+  size_t written = file.write((const uint8_t*)events, bytes);
+  file.close();
+  mqttSpoolSize += written;
+  mqttSpooled += written / sizeof(IREvent);
+}
+
+// Read the oldest spooled events without consuming them
+int readMqttSpool(IREvent* events, int maxCount) {
+  if (mqttSpoolReadPos >= mqttSpoolSize) {
+    return 0;
+  }
+  File file = LittleFS.open(MQTT_SPOOL_FILE, FILE_READ);
+  if (!file) {
+    mqttSpoolReadPos = mqttSpoolSize = 0;
+    return 0;
+  }
+  file.seek(mqttSpoolReadPos);
+  size_t bytes = file.read((uint8_t*)events, maxCount * sizeof(IREvent));
+  file.close();
+  return bytes / sizeof(IREvent);
+}
+
+// The read position is kept in NVS so published events are not sent again after a reboot.
+// A Preferences object of its own: the global one belongs to the loop task.
+void saveMqttSpoolPos() {
+  Preferences spoolState;
+  spoolState.begin("mqttspool", false);
+  if (mqttSpoolReadPos > 0) {
+    spoolState.putUInt("pos", mqttSpoolReadPos);
+  } else {
+    spoolState.remove("pos");
+  }
+  spoolState.end();
+}
+
+void consumeMqttSpool(int count) {
+  mqttSpoolReadPos += count * sizeof(IREvent);
+  if (mqttSpoolReadPos >= mqttSpoolSize) {
+    LittleFS.remove(MQTT_SPOOL_FILE);
+    mqttSpoolReadPos = mqttSpoolSize = 0;
+  }
+  saveMqttSpoolPos();
+}
+
+// Pick up a spool left by the previous boot, from where its publishing stopped
+void loadMqttSpool() {
+  mqttSpoolReadPos = mqttSpoolSize = 0;
+  if (!flashMounted) {
+    return;
+  }
+  if (!LittleFS.exists(MQTT_SPOOL_FILE)) {
+    saveMqttSpoolPos();
+    return;
+  }
+  File spool = LittleFS.open(MQTT_SPOOL_FILE, FILE_READ);
+  mqttSpoolSize = spool.size() - spool.size() % sizeof(IREvent);
+  spool.close();
+  Preferences spoolState;
+  spoolState.begin("mqttspool", true);
+  size_t pos = spoolState.getUInt("pos", 0);
+  spoolState.end();
+  mqttSpoolReadPos = pos - pos % sizeof(IREvent);
+  if (mqttSpoolReadPos >= mqttSpoolSize) {
+    consumeMqttSpool(0);
+    return;
+  }
+  Serial.println("MQTT spool holds " + String((mqttSpoolSize - mqttSpoolReadPos) / sizeof(IREvent)) + " unsent events");
+}
+
+// Buffer an event in RAM, spilling the oldest batch to flash when the buffer is full.
+// Codes without a saved label get their library label here, off the capture core.
+void pushMqttPending(IREvent event) {
+  LibraryRecord record;
+  if (event.label[0] == '\0' && findLibraryRecord(event.protocol, event.address, event.command, &record)) {
+    copyEventField(event.label, sizeof(event.label), record.label);
+  }
+  if (mqttPendingCount == MQTT_PENDING_LENGTH) {
+    IREvent spill[MQTT_MAX_BATCH];
+    for (int i = 0; i < MQTT_MAX_BATCH; i++) {
+      spill[i] = mqttPending[(mqttPendingHead + i) % MQTT_PENDING_LENGTH];
+    }
+    spoolMqttEvents(spill, MQTT_MAX_BATCH);
+    mqttPendingHead = (mqttPendingHead + MQTT_MAX_BATCH) % MQTT_PENDING_LENGTH;
+    mqttPendingCount -= MQTT_MAX_BATCH;
+  }
+  mqttPending[(mqttPendingHead + mqttPendingCount) % MQTT_PENDING_LENGTH] = event;
+  mqttPendingCount++;
+}
+
+int peekMqttPending(IREvent* events, int maxCount) {
+  int count = min(mqttPendingCount, maxCount);
+  for (int i = 0; i < count; i++) {
+    events[i] = mqttPending[(mqttPendingHead + i) % MQTT_PENDING_LENGTH];
+  }
+  return count;
+}
+
+void consumeMqttPending(int count) {
+  mqttPendingHead = (mqttPendingHead + count) % MQTT_PENDING_LENGTH;
+  mqttPendingCount -= count;
+}
+
+// Publish a batch of events as one JSON message
+bool publishMqttBatch(const IREvent* events, int count) {
+  size_t cap = sizeof(mqttPayload);
+  size_t len = snprintf(mqttPayload, cap, "{\"device\":\"%s\",\"events\":[", mqttClientId);
+  for (int i = 0; i < count && len < cap; i++) {
+    len += snprintf(mqttPayload + len, cap - len,
+                    "%s{\"seq\":%lu,\"time\":%lu,\"protocol\":\"%s\",\"address\":\"0x%x\",\"command\":\"0x%x\",\"label\":\"%s\"}",
+                    i > 0 ? "," : "", (unsigned long)events[i].sequence, (unsigned long)events[i].timestampMs,
+                    events[i].protocol, events[i].address, events[i].command, events[i].label);
+  }
+  if (len < cap) {
+    len += snprintf(mqttPayload + len, cap - len, "]}");
+  }
+  if (len >= cap) {
+    return false;
+  }
+  if (!mqttClient.publish(mqttEventsTopic, (const uint8_t*)mqttPayload, len, false)) {
+    return false;
+  }
+  mqttPublished += count;
+  mqttBatches++;
+  return true;
+}
+
+bool connectToMqtt() {
+  bool ok = mqttClient.connect(mqttClientId,
+                               mqttUserBuf[0] ? mqttUserBuf : NULL,
+                               mqttUserBuf[0] ? mqttPasswordBuf : NULL,
+                               mqttStatusTopic, 0, true, "offline");
+  if (ok) {
+    mqttClient.publish(mqttStatusTopic, "online", true);
+  }
+  return ok;
+}
+
+// One pass of the publisher: collect queued events, keep the broker connection up and publish
+// whatever is pending. Waits at most 100 ms for new events.
+void serviceMqtt() {
+  IREvent event;
+  IREvent batch[MQTT_MAX_BATCH];
+
+  // Wait for the next event, then linger briefly so bursts share one publish; the linger is
+  // counted from the first event, so a steady stream still goes out every 50 ms
+  if (xQueueReceive(mqttQueue, &event, pdMS_TO_TICKS(100)) == pdTRUE) {
+    pushMqttPending(event);
+    unsigned long lingerStart = millis();
+    unsigned long lingered;
+    while (mqttPendingCount < MQTT_MAX_BATCH && (lingered = millis() - lingerStart) < MQTT_BATCH_LINGER_MS &&
+           xQueueReceive(mqttQueue, &event, pdMS_TO_TICKS(MQTT_BATCH_LINGER_MS - lingered)) == pdTRUE) {
+      pushMqttPending(event);
+    }
+    while (xQueueReceive(mqttQueue, &event, 0) == pdTRUE) {
+      pushMqttPending(event);
+    }
+  }
+
+  if (mqttConfigChanged) {
+    mqttConfigChanged = false;
+    mqttClient.disconnect();
+    applyMqttConfig();
+    mqttAttempted = false;
+  }
+
+  if (!mqttConfigured || WiFi.status() != WL_CONNECTED) {
+    mqttConnected = false;
+    return;
+  }
+
+  if (!mqttClient.connected()) {
+    mqttConnected = false;
+    if (mqttAttempted && millis() - mqttLastAttempt < MQTT_RECONNECT_MS) {
+      return;
+    }
+    mqttAttempted = true;
+    mqttLastAttempt = millis();
+    if (!connectToMqtt()) {
+      return;
+    }
+  }
+  mqttConnected = true;
+  mqttClient.loop();
+  
+  // Messages from rules go out as they are
+  MqttMessage message;
+  while (mqttMessageQueue != NULL && xQueueReceive(mqttMessageQueue, &message, 0) == pdTRUE) {
+    mqttClient.publish(message.topic, message.payload);
+  }
+
+  // Spooled events are older than the RAM buffer, so they go out first
+  int count;
+  while ((count = readMqttSpool(batch, MQTT_MAX_BATCH)) > 0) {
+    if (!publishMqttBatch(batch, count)) {
+      break;
+    }
+    consumeMqttSpool(count);
+  }
+  if (mqttSpoolSize > 0) {
+    return;
+  }
+  while ((count = peekMqttPending(batch, MQTT_MAX_BATCH)) > 0) {
+    if (!publishMqttBatch(batch, count)) {
+      break;
+    }
+    consumeMqttPending(count);
+  }
+}
+
+void mqttTask(void* parameter) {
+  applyMqttConfig();
+  mqttClient.setBufferSize(sizeof(mqttPayload) + sizeof(mqttEventsTopic) + 16);
+  mqttClient.setSocketTimeout(2);
+
+  for (;;) {
+    serviceMqtt();
+  }
+}
+
+// Handler for MQTT status
+void handleMqttStatus() {
+  String json = "{";
+  json += "\"configured\":" + String(mqttConfigured ? "true" : "false") + ",";
+  json += "\"connected\":" + String(mqttConnected ? "true" : "false") + ",";
+  json += "\"host\":\"" + jsonEscape(mqtt_host) + "\",";
+  json += "\"port\":" + String(mqtt_port) + ",";
+  json += "\"user\":\"" + jsonEscape(mqtt_user) + "\",";
+  json += "\"topic\":\"" + jsonEscape(mqtt_topic) + "\",";
+  json += "\"published\":" + String(mqttPublished) + ",";
+  json += "\"batches\":" + String(mqttBatches) + ",";
+  json += "\"pending\":" + String(mqttPendingCount) + ",";
+  json += "\"spooled\":" + String(mqttSpoolSize > mqttSpoolReadPos ? (mqttSpoolSize - mqttSpoolReadPos) / sizeof(IREvent) : 0) + ",";
+  json += "\"dropped\":" + String(mqttDropped.load());
+  json += "}";
+  server.send(200, "application/json", json);
+}
+
+// Handler for saving MQTT configuration
+void handleMqttConfig() {
+  if (server.method() != HTTP_POST) {
+    server.send(405, "text/plain", "Method Not Allowed");
+    return;
+  }
+  
+  String host = server.arg("host");
+  String topic = server.arg("topic");
+  long port = server.hasArg("port") ? server.arg("port").toInt() : 1883;
+  
+  if (port <= 0 || port > 65535) {
+    server.send(200, "application/json", "{\"success\":false,\"message\":\"Invalid port!\"}");
+    return;
+  }
+  if (topic.length() == 0) {
+    topic = "esp32ir";
+  }
+  
+  saveMqttConfig(host, port, server.arg("user"), server.arg("password"), topic);
+  loadMqttConfig();
+  mqttConfigChanged = true;
+  
+  server.send(200, "application/json", "{\"success\":true,\"message\":\"MQTT configuration saved!\"}");
+}
+
 void setup() { 
   Serial.begin(115200); 
   delay(200); 
   
+  // Heap monitoring; the last-signal strings and the saved-command list get fixed buffers
+  // at boot so saving and clearing commands never moves them around the heap
+  heap_caps_register_failed_alloc_callback(onAllocFailed);
+  savedCommands.reserve(MAX_SAVED_COMMANDS);
+  lastProtocol.reserve(24);
+  lastAddress.reserve(8);
+  lastCommand.reserve(8);
+  lastRawData.reserve(192);
+  
   // LED configuration
   pinMode(LED_PIN, OUTPUT);
   digitalWrite(LED_PIN, LOW);
@@ -815,21 +4196,58 @@ void setup() {
   // IR receiver configuration
   IrReceiver.begin(IR_RECEIVE_PIN, ENABLE_LED_FEEDBACK); 
   Serial.println("KY-022 + ESP32: IR receiver ready."); 
+  loadDecoderProfile();
+  
+  // The receiver pin's first edge wakes loop(); frames are still captured by IRremote
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  attachInterrupt(digitalPinToInterrupt(IR_RECEIVE_PIN), onIrEdge, FALLING);
   
   // Load WiFi credentials from EEPROM
   Serial.println("\n=== WIFI CONFIGURATION ===");
   loadWiFiCredentials();
   
+  // Flash file system for the MQTT offline spool and the code library
+  libraryMutex = xSemaphoreCreateMutex();
+  flashMounted = LittleFS.begin(true);
+  if (!flashMounted) {
+    Serial.println("❌ LittleFS mount failed, MQTT spool and code library disabled");
+  } else {
+    loadLibraryIndex();
+  }
+  loadMqttSpool();
+  
+  // Signals, saved commands and recent events that survived a warm reset
+  restoreRtcHistory();
+  
   // Try WiFi connection or start Access Point
   if (wifiConfigured && connectToWiFi()) {
     Serial.println("\n✅ Mode: WiFi Client");
     Serial.println("Open in browser: http://" + WiFi.localIP().toString());
+    configureLightSleep();
   } else {
     startAccessPoint();
     Serial.println("\n📡 Mode: Access Point");
     Serial.println("Open in browser: http://" + WiFi.softAPIP().toString());
   }
   
+  // Time-series counters, restored from flash; wall-clock time via NTP in station mode
+  beginTimeSeries();
+  
+  // Rules: compiled from Preferences, slow actions run on a worker task on core 0
+  Serial.println("\n=== RULES ===");
+  IrSender.begin(IR_TRANSMIT_PIN);
+  ruleQueue = xQueueCreate(RULE_QUEUE_LENGTH, sizeof(RuleJob));
+  mqttMessageQueue = xQueueCreate(RULE_QUEUE_LENGTH, sizeof(MqttMessage));
+  loadRules();
+  xTaskCreatePinnedToCore(ruleWorkerTask, "rules", 6144, NULL, 1, NULL, 0);
+  
+  // MQTT publisher runs on core 0 so publishing never stalls the capture loop
+  Serial.println("\n=== MQTT CONFIGURATION ===");
+  mqttConfigMutex = xSemaphoreCreateMutex();
+  loadMqttConfig();
+  mqttQueue = xQueueCreate(MQTT_QUEUE_LENGTH, sizeof(IREvent));
+  xTaskCreatePinnedToCore(mqttTask, "mqtt", 6144, NULL, 1, NULL, 0);
+  
   // Web server configuration
   server.on("/", handleRoot);
   server.on("/data", handleData);
@@ -837,54 +4255,100 @@ void setup() {
   server.on("/download", handleDownload);
   server.on("/clear", handleClear);
   server.on("/count", handleCount);
+  server.on("/commands", handleCommands);
+  server.on("/command", HTTP_GET, handleCommand);
+  server.on("/command", HTTP_DELETE, handleCommand);
+  server.on("/import", HTTP_POST, handleImport, handleImportUpload);
+  server.on("/library", handleLibrary);
+  server.on("/library_clear", handleLibraryClear);
+  server.on("/stats", handleStats);
+  server.on("/stats_clear", handleStatsClear);
+  server.on("/timeseries", handleTimeSeries);
+  server.on("/rules", handleRules);
+  server.on("/rules_clear", handleRulesClear);
+  server.on("/decoders", handleDecoders);
+  server.on("/heap", handleHeap);
+  server.on("/power", handlePower);
+  server.on("/history", handleHistory);
   server.on("/wifi_status", handleWiFiStatus);
   server.on("/wifi_config", handleWiFiConfig);
   server.on("/wifi_clear", handleWiFiClear);
+  server.on("/mqtt_status", handleMqttStatus);
+  server.on("/mqtt_config", handleMqttConfig);
   server.begin();
   
+  takeHeapSample();
+  
   Serial.println("\n✅ Web server started!");
-  Serial.println("Functions: IR monitoring, save commands, WiFi configuration");
+  Serial.println("Functions: IR monitoring, save commands, WiFi configuration, MQTT publishing");
   Serial.println("========================\n");
 } 
 
 void loop() 
 { 
+  // Block until the IR edge interrupt or the next deadline (frame poll, LED, HTTP poll)
+  waitForWork(loopWaitBudget(millis(), lastHttpActivity, irEdgePending, ledOn, ledOffAt));
+  
   // Process HTTP requests
   server.handleClient();
+  if (server.client()) {
+    lastHttpActivity = millis();
+  }
   
   // Check IR signals
-  if (IrReceiver.decode()) 
+  if (decodeWithProfile()) 
   { 
+    recordWakeToDecode();
     digitalWrite(LED_PIN, HIGH);
     signalCount++;
     
     Serial.println("\n=== IR SIGNAL RECEIVED ===");
     
     // Extract data
-    lastProtocol = String(getProtocolString(IrReceiver.decodedIRData.protocol));
-    lastAddress = "0x" + String(IrReceiver.decodedIRData.address, HEX);
-    lastCommand = "0x" + String(IrReceiver.decodedIRData.command, HEX);
+    lastEvent.time = timelineSeconds();
+    lastEvent.rawData = IrReceiver.decodedIRData.decodedRawData;
+    lastEvent.address = IrReceiver.decodedIRData.address;
+    lastEvent.command = IrReceiver.decodedIRData.command;
+    lastEvent.bits = IrReceiver.decodedIRData.numberOfBits;
+    lastEvent.protocol = IrReceiver.decodedIRData.protocol;
+    lastEvent.flags = IrReceiver.decodedIRData.flags;
     lastReceiveTime = millis();
     
-    // Extract RAW data - simplified format
-    lastRawData = "Protocol: " + lastProtocol + "\n";
-    lastRawData += "Address: " + lastAddress + "\n";
-    lastRawData += "Command: " + lastCommand + "\n";
-    lastRawData += "Flags: 0x" + String(IrReceiver.decodedIRData.flags, HEX) + "\n";
-    lastRawData += "Raw Code: 0x" + String(IrReceiver.decodedIRData.decodedRawData, HEX) + "\n";
-    lastRawData += "Bits: " + String(IrReceiver.decodedIRData.numberOfBits);
+    // Rules run before any printing so their latency does not depend on the serial port
+    evaluateRules();
+    
+    // Last-signal fields and the crash-surviving RTC history (no flash write here)
+    setLastSignal(lastEvent);
+    recordHistoryEvent();
     
     // Display in Serial
     Serial.print("Protocol: "); Serial.println(lastProtocol);
     Serial.print("Address: "); Serial.println(lastAddress);
     Serial.print("Command: "); Serial.println(lastCommand);
-    Serial.println("Raw: " + lastRawData);
+    Serial.print("Raw: "); Serial.println(lastRawData);
+    
+    queueMqttEvent();
+    recordSignalStats();
+    recordTimeSeriesEvent(IrReceiver.decodedIRData.protocol, IrReceiver.decodedIRData.address,
+                          IrReceiver.decodedIRData.command);
     
     IrReceiver.resume(); 
     
-    delay(200);
+    ledOn = true;
+    ledOffAt = millis() + LED_HOLD_MS;
+  }
+  else if (irEdgePending && micros() - irEdgeMicros > FRAME_TIMEOUT_MS * 1000UL)
+  {
+    edgesWithoutFrame++;
+    endIrFrame();
+  }
+  
+  if (ledOn && (long)(millis() - ledOffAt) >= 0) {
     digitalWrite(LED_PIN, LOW);
+    ledOn = false;
   }
   
-  delay(10);
+  serviceTimeSeries();
+  serviceHeapMonitor();
+  serviceHistory();
 }
\ No newline at end of file
@@ -0,0 +1,403 @@
+// Host mock of the Arduino-ESP32 core, just enough to compile src/main.cpp natively.
+// Time is simulated (mock::nowMicros) and String allocates through mock::heapRealloc /
+// mock::heapFree, so a test can run the firmware against a model of the ESP32 heap.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <functional>
+
+using std::min;
+using std::max;
+
+#define PROGMEM
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define bit(b) (1UL << (b))
+#define digitalPinToInterrupt(p) (p)
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+namespace mock {
+
+// Simulated clock; tests advance it explicitly or through blocking FreeRTOS calls
+inline uint64_t nowMicros = 0;
+
+inline void advanceMicros(uint64_t micros) {
+  nowMicros += micros;
+}
+
+inline void advanceMillis(uint64_t millis) {
+  nowMicros += millis * 1000;
+}
+
+// Device heap used by String; a test can point these at a heap model
+inline void* (*heapRealloc)(void*, size_t) = realloc;
+inline void (*heapFree)(void*) = free;
+
+// Allocations made while a HostScope is open belong to the mocks, not to the device
+inline int hostScope = 0;
+struct HostScope {
+  HostScope() { hostScope++; }
+  ~HostScope() { hostScope--; }
+};
+
+inline int pinLevel[40] = { 0 };
+inline void (*pinInterrupt[40])() = { nullptr };
+
+}  // namespace mock
+
+// Same storage policy as the core's WString: up to 11 characters are stored inline, longer
+// strings get a heap buffer resized to the exact length needed
+class String {
+ public:
+  String(const char* cstr = "") { if (cstr) copy(cstr, strlen(cstr)); }
+  String(const String& other) { copy(other.c_str(), other.len); }
+  String(String&& other) noexcept { moveFrom(other); }
+  explicit String(char c) { char text[2] = { c, 0 }; copy(text, 1); }
+  explicit String(unsigned char value, unsigned char base = 10) { formatUnsigned(value, base); }
+  explicit String(int value, unsigned char base = 10) { formatSigned(value, base); }
+  explicit String(unsigned int value, unsigned char base = 10) { formatUnsigned(value, base); }
+  explicit String(long value, unsigned char base = 10) { formatSigned(value, base); }
+  explicit String(unsigned long value, unsigned char base = 10) { formatUnsigned(value, base); }
+  explicit String(long long value, unsigned char base = 10) { formatSigned(value, base); }
+  explicit String(unsigned long long value, unsigned char base = 10) { formatUnsigned(value, base); }
+  explicit String(float value, unsigned int decimalPlaces = 2) { formatFloat(value, decimalPlaces); }
+  explicit String(double value, unsigned int decimalPlaces = 2) { formatFloat(value, decimalPlaces); }
+  ~String() { release(); }
+
+  String& operator=(const String& other) {
+    if (this != &other) {
+      copy(other.c_str(), other.len);
+    }
+    return *this;
+  }
+  String& operator=(String&& other) noexcept {
+    if (this != &other) {
+      release();
+      moveFrom(other);
+    }
+    return *this;
+  }
+  String& operator=(const char* cstr) {
+    copy(cstr ? cstr : "", cstr ? strlen(cstr) : 0);
+    return *this;
+  }
+
+  bool reserve(unsigned int size) {
+    if (capacity >= size) {
+      return true;
+    }
+    char* grown = (char*)mock::heapRealloc(onHeap() ? buffer : nullptr, size + 1);
+    if (grown == nullptr) {
+      return false;
+    }
+    if (!onHeap()) {
+      memcpy(grown, inlineBuffer, len + 1);
+    }
+    buffer = grown;
+    capacity = size;
+    return true;
+  }
+
+  unsigned int length() const { return len; }
+  const char* c_str() const { return buffer; }
+  bool isEmpty() const { return len == 0; }
+  char charAt(unsigned int index) const { return index < len ? buffer[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char& operator[](unsigned int index) {
+    static char dummy;
+    return index < len ? buffer[index] : dummy;
+  }
+
+  bool concat(const char* cstr, unsigned int length) {
+    if (length == 0) {
+      return true;
+    }
+    if (!reserve(len + length)) {
+      return false;
+    }
+    memmove(buffer + len, cstr, length);
+    len += length;
+    buffer[len] = 0;
+    return true;
+  }
+  bool concat(const String& other) { return concat(other.c_str(), other.len); }
+  bool concat(const char* cstr) { return cstr ? concat(cstr, strlen(cstr)) : false; }
+  bool concat(char c) { return concat(&c, 1); }
+
+  String& operator+=(const String& other) { concat(other); return *this; }
+  String& operator+=(const char* cstr) { concat(cstr); return *this; }
+  String& operator+=(char c) { concat(c); return *this; }
+  String& operator+=(int value) { concat(String(value)); return *this; }
+  String& operator+=(unsigned int value) { concat(String(value)); return *this; }
+  String& operator+=(long value) { concat(String(value)); return *this; }
+  String& operator+=(unsigned long value) { concat(String(value)); return *this; }
+  String& operator+=(float value) { concat(String(value)); return *this; }
+  String& operator+=(double value) { concat(String(value)); return *this; }
+
+  bool equals(const String& other) const { return len == other.len && strcmp(c_str(), other.c_str()) == 0; }
+  bool equals(const char* cstr) const { return strcmp(c_str(), cstr ? cstr : "") == 0; }
+  bool equalsIgnoreCase(const String& other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+  bool operator==(const String& other) const { return equals(other); }
+  bool operator==(const char* cstr) const { return equals(cstr); }
+  bool operator!=(const String& other) const { return !equals(other); }
+  bool operator!=(const char* cstr) const { return !equals(cstr); }
+  bool operator<(const String& other) const { return strcmp(c_str(), other.c_str()) < 0; }
+
+  bool startsWith(const String& prefix) const {
+    return prefix.len <= len && strncmp(c_str(), prefix.c_str(), prefix.len) == 0;
+  }
+  bool endsWith(const String& suffix) const {
+    return suffix.len <= len && strcmp(c_str() + len - suffix.len, suffix.c_str()) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const {
+    if (from >= len) {
+      return -1;
+    }
+    const char* found = strchr(c_str() + from, c);
+    return found ? found - c_str() : -1;
+  }
+  int indexOf(const String& text, unsigned int from = 0) const {
+    if (from > len) {
+      return -1;
+    }
+    const char* found = strstr(c_str() + from, text.c_str());
+    return found ? found - c_str() : -1;
+  }
+  int lastIndexOf(char c) const {
+    const char* found = strrchr(c_str(), c);
+    return found ? found - c_str() : -1;
+  }
+  String substring(unsigned int from) const { return substring(from, len); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) {
+      std::swap(from, to);
+    }
+    to = std::min(to, len);
+    String out;
+    if (from < to) {
+      out.copy(c_str() + from, to - from);
+    }
+    return out;
+  }
+
+  void replace(char find, char with) {
+    for (unsigned int i = 0; i < len; i++) {
+      if (buffer[i] == find) {
+        buffer[i] = with;
+      }
+    }
+  }
+  void replace(const String& find, const String& with) {
+    if (find.len == 0 || indexOf(find) < 0) {
+      return;
+    }
+    String out;
+    unsigned int pos = 0;
+    int hit;
+    while ((hit = indexOf(find, pos)) >= 0) {
+      out.concat(c_str() + pos, hit - pos);
+      out.concat(with);
+      pos = hit + find.len;
+    }
+    out.concat(c_str() + pos, len - pos);
+    *this = out;
+  }
+  void remove(unsigned int index) { remove(index, len); }
+  void remove(unsigned int index, unsigned int count) {
+    if (index >= len) {
+      return;
+    }
+    count = std::min(count, len - index);
+    memmove(buffer + index, buffer + index + count, len - index - count + 1);
+    len -= count;
+  }
+  void clear() {
+    len = 0;
+    buffer[0] = 0;
+  }
+  void trim() {
+    unsigned int start = 0;
+    while (start < len && isspace((unsigned char)buffer[start])) {
+      start++;
+    }
+    unsigned int end = len;
+    while (end > start && isspace((unsigned char)buffer[end - 1])) {
+      end--;
+    }
+    if (start > 0 || end < len) {
+      memmove(buffer, buffer + start, end - start);
+      len = end - start;
+      buffer[len] = 0;
+    }
+  }
+  void toLowerCase() { for (unsigned int i = 0; i < len; i++) buffer[i] = tolower((unsigned char)buffer[i]); }
+  void toUpperCase() { for (unsigned int i = 0; i < len; i++) buffer[i] = toupper((unsigned char)buffer[i]); }
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return atof(c_str()); }
+
+ private:
+  static const unsigned int INLINE_SIZE = 11;
+  char inlineBuffer[INLINE_SIZE + 1] = { 0 };
+  char* buffer = inlineBuffer;
+  unsigned int capacity = INLINE_SIZE;
+  unsigned int len = 0;
+
+  bool onHeap() const { return buffer != inlineBuffer; }
+  void release() {
+    if (onHeap()) {
+      mock::heapFree(buffer);
+    }
+    buffer = inlineBuffer;
+    capacity = INLINE_SIZE;
+    len = 0;
+    inlineBuffer[0] = 0;
+  }
+
+  void copy(const char* cstr, unsigned int length) {
+    if (!reserve(length)) {
+      return;
+    }
+    memmove(buffer, cstr, length);
+    len = length;
+    buffer[len] = 0;
+  }
+  void moveFrom(String& other) {
+    if (other.onHeap()) {
+      buffer = other.buffer;
+      capacity = other.capacity;
+      len = other.len;
+      other.buffer = other.inlineBuffer;
+      other.capacity = INLINE_SIZE;
+      other.len = 0;
+      other.inlineBuffer[0] = 0;
+    } else {
+      copy(other.inlineBuffer, other.len);
+    }
+  }
+  void formatUnsigned(unsigned long long value, unsigned char base) {
+    char text[72];
+    char* p = text + sizeof(text) - 1;
+    *p = 0;
+    do {
+      int digit = value % base;
+      *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+      value /= base;
+    } while (value > 0);
+    copy(p, strlen(p));
+  }
+  void formatSigned(long long value, unsigned char base) {
+    if (base == 10 && value < 0) {
+      formatUnsigned(-(unsigned long long)value, base);
+      String minus("-");
+      minus.concat(*this);
+      *this = minus;
+    } else {
+      formatUnsigned(base == 10 ? (unsigned long long)value : (unsigned long long)(unsigned long)value, base);
+    }
+  }
+  void formatFloat(double value, unsigned int decimalPlaces) {
+    char text[40];
+    snprintf(text, sizeof(text), "%.*f", decimalPlaces, value);
+    copy(text, strlen(text));
+  }
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String out(lhs); out.concat(rhs); return out; }
+inline String operator+(const String& lhs, const char* rhs) { String out(lhs); out.concat(rhs); return out; }
+inline String operator+(const char* lhs, const String& rhs) { String out(lhs); out.concat(rhs); return out; }
+inline String operator+(const String& lhs, char rhs) { String out(lhs); out.concat(rhs); return out; }
+
+class Print;
+
+class Printable {
+ public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) { return 1; }
+  virtual size_t write(const uint8_t*, size_t size) { return size; }
+  size_t print(const String& text) { return text.length(); }
+  size_t print(const char* text) { return strlen(text); }
+  size_t print(char) { return 1; }
+  size_t print(int value, int = DEC) { return print(String(value)); }
+  size_t print(unsigned int value, int = DEC) { return print(String(value)); }
+  size_t print(long value, int = DEC) { return print(String(value)); }
+  size_t print(unsigned long value, int = DEC) { return print(String(value)); }
+  size_t print(double value, int digits = 2) { return print(String(value, digits)); }
+  size_t print(const Printable& value) { return value.printTo(*this); }
+  size_t println() { return 2; }
+  template <typename T> size_t println(T value) { return print(value) + 2; }
+  template <typename T> size_t println(T value, int format) { return print(value, format) + 2; }
+  size_t printf(const char*, ...) { return 0; }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+};
+
+inline HardwareSerial Serial;
+
+inline unsigned long millis() { return mock::nowMicros / 1000; }
+inline unsigned long micros() { return mock::nowMicros; }
+inline void delay(unsigned long ms) { mock::advanceMillis(ms); }
+inline void delayMicroseconds(unsigned int us) { mock::advanceMicros(us); }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t pin, uint8_t level) { mock::pinLevel[pin] = level; }
+inline int digitalRead(uint8_t pin) { return mock::pinLevel[pin]; }
+inline void attachInterrupt(uint8_t pin, void (*handler)(), int) { mock::pinInterrupt[pin] = handler; }
+inline void detachInterrupt(uint8_t pin) { mock::pinInterrupt[pin] = nullptr; }
+
+class EspClass {
+ public:
+  void restart() {}
+  uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ULL; }
+};
+
+inline EspClass ESP;
+
+#if !defined(__APPLE__) && !(defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 38)))
+inline size_t strlcpy(char* dest, const char* src, size_t size) {
+  size_t length = strlen(src);
+  if (size > 0) {
+    size_t copied = length < size - 1 ? length : size - 1;
+    memcpy(dest, src, copied);
+    dest[copied] = 0;
+  }
+  return length;
+}
+#endif
+
+#include "mock_freertos.h"
@@ -0,0 +1,23 @@
+// HTTPClient mock: records the requested URLs and answers 200
+#pragma once
+
+#include <WiFi.h>
+#include <vector>
+
+namespace mock {
+
+inline std::vector<std::string> httpRequests;
+
+}  // namespace mock
+
+class HTTPClient {
+ public:
+  void setTimeout(uint16_t) {}
+  bool begin(const String& url) {
+    mock::HostScope host;
+    mock::httpRequests.push_back(url.c_str());
+    return true;
+  }
+  int GET() { return 200; }
+  void end() {}
+};
@@ -0,0 +1,195 @@
+// IRremote mock: frames are injected with mock::receiveFrame() and each decodeXxx() accepts
+// only the protocols the real decoder would. Every decoder attempt costs
+// mock::decodeAttemptMicros of simulated time, so decode-time accounting can be compared.
+#pragma once
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+
+// Same default as IRremote: without a DECODE_* selection every decoder is built in
+#if !defined(DECODE_NEC) && !defined(DECODE_SONY) && !defined(DECODE_RC5) && !defined(DECODE_RC6) && \
+    !defined(DECODE_SAMSUNG) && !defined(DECODE_KASEIKYO) && !defined(DECODE_PANASONIC) && \
+    !defined(DECODE_JVC) && !defined(DECODE_LG) && !defined(DECODE_DENON) && !defined(DECODE_SHARP) && \
+    !defined(DECODE_ONKYO) && !defined(DECODE_DISTANCE_WIDTH) && !defined(DECODE_HASH)
+#define DECODE_DENON
+#define DECODE_JVC
+#define DECODE_KASEIKYO
+#define DECODE_PANASONIC
+#define DECODE_LG
+#define DECODE_NEC
+#define DECODE_SAMSUNG
+#define DECODE_SONY
+#define DECODE_RC5
+#define DECODE_RC6
+#define DECODE_BOSEWAVE
+#define DECODE_LEGO_PF
+#define DECODE_MAGIQUEST
+#define DECODE_WHYNTER
+#define DECODE_FAST
+#define DECODE_DISTANCE_WIDTH
+#define DECODE_HASH
+#endif
+
+#define ENABLE_LED_FEEDBACK true
+#define MICROS_PER_TICK 50
+#define RAW_BUFFER_LENGTH 200
+
+#define IRDATA_FLAGS_IS_REPEAT 0x01
+#define IRDATA_FLAGS_IS_AUTO_REPEAT 0x02
+#define IRDATA_FLAGS_PARITY_FAILED 0x04
+#define IRDATA_FLAGS_WAS_OVERFLOW 0x40
+
+typedef enum {
+  UNKNOWN = 0, PULSE_WIDTH, PULSE_DISTANCE, APPLE, DENON, JVC, LG, LG2, NEC, NEC2, ONKYO, PANASONIC,
+  KASEIKYO, KASEIKYO_DENON, KASEIKYO_SHARP, KASEIKYO_JVC, KASEIKYO_MITSUBISHI, RC5, RC6, RC6A,
+  SAMSUNG, SAMSUNGLG, SAMSUNG48, SHARP, SONY, BANG_OLUFSEN, BOSEWAVE, LEGO_PF, MAGIQUEST, WHYNTER, FAST
+} decode_type_t;
+
+typedef uint_fast16_t IRRawlenType;
+typedef uint16_t IRRawbufType;
+typedef uint64_t IRRawDataType;
+
+struct irparams_struct {
+  volatile uint8_t StateForISR;
+  IRRawlenType rawlen;
+  IRRawbufType rawbuf[RAW_BUFFER_LENGTH];
+};
+
+struct IRData {
+  decode_type_t protocol;
+  uint16_t address;
+  uint16_t command;
+  uint16_t extra;
+  IRRawDataType decodedRawData;
+  uint16_t numberOfBits;
+  uint8_t flags;
+  irparams_struct* rawDataPtr;
+};
+
+inline const char* getProtocolString(decode_type_t protocol) {
+  static const char* const names[] = {
+    "UNKNOWN", "PulseWidth", "PulseDistance", "Apple", "Denon", "JVC", "LG", "LG2", "NEC", "NEC2",
+    "Onkyo", "Panasonic", "Kaseikyo", "Kaseikyo_Denon", "Kaseikyo_Sharp", "Kaseikyo_JVC",
+    "Kaseikyo_Mitsubishi", "RC5", "RC6", "RC6A", "Samsung", "SamsungLG", "Samsung48", "Sharp", "Sony",
+    "Bang&Olufsen", "BoseWave", "Lego", "MagiQuest", "Whynter", "FAST"
+  };
+  return protocol <= FAST ? names[protocol] : "UNKNOWN";
+}
+
+namespace mock {
+
+struct IrFrame {
+  decode_type_t protocol;
+  uint16_t address;
+  uint16_t command;
+  uint8_t flags;
+};
+
+inline IrFrame pendingFrame;
+inline bool framePending = false;
+inline uint32_t decodeAttemptMicros = 20;
+inline uint32_t decodeAttempts = 0;
+inline uint16_t leaderLostTicks = 0;        // leader mark missed while the receiver timer was stopped
+
+}  // namespace mock
+
+class IRrecv {
+ public:
+  IRData decodedIRData;
+  irparams_struct irparams;
+
+  void begin(uint8_t, bool = false, uint8_t = 0) { decodedIRData.rawDataPtr = &irparams; }
+  void start() {}
+  void stop() {}
+  bool available() { return mock::framePending; }
+  void resume() { mock::framePending = false; }
+  void initDecodedIRData() {
+    decodedIRData.rawDataPtr = &irparams;
+    decodedIRData.protocol = UNKNOWN;
+    decodedIRData.flags = mock::pendingFrame.flags;
+    decodedIRData.decodedRawData = 0;
+  }
+  bool decode() {
+    if (!available()) {
+      return false;
+    }
+    initDecodedIRData();
+    return decodeNEC() || decodeSamsung() || decodeSony() || decodeRC5() || decodeRC6() || decodeHash();
+  }
+
+  bool decodeNEC() { return accept({ NEC, NEC2, APPLE, ONKYO }, 32); }
+  bool decodeKaseikyo() { return accept({ PANASONIC, KASEIKYO, KASEIKYO_DENON, KASEIKYO_SHARP, KASEIKYO_JVC }, 48); }
+  bool decodeDenon() { return accept({ DENON, SHARP }, 15); }
+  bool decodeSony() { return accept({ SONY }, 12); }
+  bool decodeRC5() { return accept({ RC5 }, 13); }
+  bool decodeRC6() { return accept({ RC6, RC6A }, 20); }
+  bool decodeLG() { return accept({ LG, LG2 }, 28); }
+  bool decodeJVC() { return accept({ JVC }, 16); }
+  bool decodeSamsung() { return accept({ SAMSUNG, SAMSUNGLG, SAMSUNG48 }, 32); }
+  bool decodeWhynter() { return accept({ WHYNTER }, 32); }
+  bool decodeLegoPowerFunctions() { return accept({ LEGO_PF }, 16); }
+  bool decodeBoseWave() { return accept({ BOSEWAVE }, 16); }
+  bool decodeMagiQuest() { return accept({ MAGIQUEST }, 56); }
+  bool decodeFAST() { return accept({ FAST }, 16); }
+  bool decodeDistanceWidth() { return accept({ PULSE_DISTANCE, PULSE_WIDTH }, 32); }
+  bool decodeHash() {
+    // Accepts anything and reports it as UNKNOWN, like IRremote
+    mock::decodeAttempts++;
+    mock::advanceMicros(mock::decodeAttemptMicros);
+    decodedIRData.protocol = UNKNOWN;
+    decodedIRData.decodedRawData = 0x811C9DC5u ^ mock::pendingFrame.command;
+    decodedIRData.numberOfBits = 32;
+    return true;
+  }
+
+ private:
+  bool accept(std::initializer_list<decode_type_t> protocols, uint16_t bits) {
+    mock::decodeAttempts++;
+    mock::advanceMicros(mock::decodeAttemptMicros);
+    for (decode_type_t protocol : protocols) {
+      if (protocol == mock::pendingFrame.protocol) {
+        decodedIRData.protocol = protocol;
+        decodedIRData.address = mock::pendingFrame.address;
+        decodedIRData.command = mock::pendingFrame.command;
+        decodedIRData.numberOfBits = bits;
+        decodedIRData.decodedRawData = (uint64_t)(uint8_t)~mock::pendingFrame.command << 24 |
+                                       (uint64_t)mock::pendingFrame.command << 16 | mock::pendingFrame.address;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+class IRsend {
+ public:
+  void begin(uint8_t) {}
+  void write(decode_type_t, uint16_t, uint16_t, int_fast8_t = 0) {}
+};
+
+inline IRrecv IrReceiver;
+inline IRsend IrSender;
+
+namespace mock {
+
+// Make a frame available to the receiver, with NEC-like raw timings (50 us ticks), and
+// fire the edge interrupt if the firmware attached one to the receive pin and has not masked it
+inline void receiveFrame(const IrFrame& frame, uint8_t pin = 14) {
+  pendingFrame = frame;
+  framePending = true;
+  irparams_struct& raw = IrReceiver.irparams;
+  raw.rawlen = 68;
+  raw.rawbuf[0] = 800;
+  raw.rawbuf[1] = 180 - leaderLostTicks;
+  raw.rawbuf[2] = 90;
+  for (int i = 3; i < 67; i += 2) {
+    raw.rawbuf[i] = 11;
+    raw.rawbuf[i + 1] = (frame.command >> (i % 8)) & 1 ? 34 : 11;
+  }
+  raw.rawbuf[67] = 11;
+  if (pinInterrupt[pin] && !gpioIntrDisabled[pin]) {
+    pinInterrupt[pin]();
+  }
+}
+
+}  // namespace mock
@@ -0,0 +1,125 @@
+// LittleFS mock: an in-memory file system (mock::files), cleared by tests as needed.
+// mock::flashWrites counts write calls, each of which is a program operation on real flash.
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+namespace mock {
+
+inline std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+inline bool flashAvailable = true;
+inline uint32_t flashWrites = 0;
+
+}  // namespace mock
+
+class File : public Stream {
+ public:
+  File() {}
+  File(std::shared_ptr<std::vector<uint8_t>> data, size_t position) : data(data), pos(position) {}
+
+  operator bool() const { return data != nullptr; }
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* bytes, size_t size) override {
+    if (!data) {
+      return 0;
+    }
+    mock::HostScope host;
+    mock::flashWrites++;
+    if (pos + size > data->size()) {
+      data->resize(pos + size);
+    }
+    memcpy(data->data() + pos, bytes, size);
+    pos += size;
+    return size;
+  }
+  size_t read(uint8_t* bytes, size_t size) {
+    if (!data || pos >= data->size()) {
+      return 0;
+    }
+    size = std::min(size, data->size() - pos);
+    memcpy(bytes, data->data() + pos, size);
+    pos += size;
+    return size;
+  }
+  int read() override {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  int available() override { return data && pos < data->size() ? data->size() - pos : 0; }
+  bool seek(uint32_t offset, SeekMode mode = SeekSet) {
+    if (!data) {
+      return false;
+    }
+    size_t base = mode == SeekSet ? 0 : mode == SeekCur ? pos : data->size();
+    if (base + offset > data->size()) {
+      return false;
+    }
+    pos = base + offset;
+    return true;
+  }
+  size_t position() const { return pos; }
+  size_t size() const { return data ? data->size() : 0; }
+  void flush() {}
+  void close() {
+    mock::HostScope host;
+    data.reset();
+  }
+
+ private:
+  std::shared_ptr<std::vector<uint8_t>> data;
+  size_t pos = 0;
+};
+
+class LittleFSFS {
+ public:
+  bool begin(bool = false) { return mock::flashAvailable; }
+  bool exists(const char* path) {
+    mock::HostScope host;
+    return mock::files.count(path) > 0;
+  }
+  File open(const char* path, const char* mode = FILE_READ) {
+    mock::HostScope host;
+    std::shared_ptr<std::vector<uint8_t>>& data = mock::files[path];
+    if (mode[0] == 'r' && !data) {
+      mock::files.erase(path);
+      return File();
+    }
+    if (!data || mode[0] == 'w') {
+      data = std::make_shared<std::vector<uint8_t>>();
+    }
+    return File(data, mode[0] == 'a' ? data->size() : 0);
+  }
+  File open(const String& path, const char* mode = FILE_READ) { return open(path.c_str(), mode); }
+  bool remove(const char* path) {
+    mock::HostScope host;
+    return mock::files.erase(path) > 0;
+  }
+  bool rename(const char* from, const char* to) {
+    mock::HostScope host;
+    if (!mock::files.count(from)) {
+      return false;
+    }
+    mock::files[to] = mock::files[from];
+    mock::files.erase(from);
+    return true;
+  }
+  size_t totalBytes() { return 1441792; }
+  size_t usedBytes() {
+    size_t used = 0;
+    for (auto& file : mock::files) {
+      used += file.second->size();
+    }
+    return used;
+  }
+};
+
+inline LittleFSFS LittleFS;
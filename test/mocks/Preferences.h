@@ -0,0 +1,74 @@
+// Preferences mock: an in-memory NVS, one key/value map per namespace
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+
+namespace mock {
+
+inline std::map<std::string, std::map<std::string, std::string>> nvs;
+
+}  // namespace mock
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool = false) {
+    mock::HostScope host;
+    space = name;
+    return true;
+  }
+  void end() {}
+  bool clear() {
+    mock::HostScope host;
+    mock::nvs[space].clear();
+    return true;
+  }
+  bool remove(const char* key) {
+    mock::HostScope host;
+    return mock::nvs[space].erase(key) > 0;
+  }
+  bool isKey(const char* key) {
+    mock::HostScope host;
+    return mock::nvs[space].count(key) > 0;
+  }
+
+  size_t putString(const char* key, const String& value) { return put(key, value.c_str()); }
+  String getString(const char* key, const String& fallback = String()) {
+    std::string value;
+    return get(key, value) ? String(value.c_str()) : fallback;
+  }
+  size_t putBool(const char* key, bool value) { return put(key, value ? "1" : "0"); }
+  bool getBool(const char* key, bool fallback = false) {
+    std::string value;
+    return get(key, value) ? value == "1" : fallback;
+  }
+  size_t putUShort(const char* key, uint16_t value) { return put(key, std::to_string(value)); }
+  uint16_t getUShort(const char* key, uint16_t fallback = 0) {
+    std::string value;
+    return get(key, value) ? (uint16_t)strtoul(value.c_str(), nullptr, 10) : fallback;
+  }
+  size_t putUInt(const char* key, uint32_t value) { return put(key, std::to_string(value)); }
+  uint32_t getUInt(const char* key, uint32_t fallback = 0) {
+    std::string value;
+    return get(key, value) ? (uint32_t)strtoul(value.c_str(), nullptr, 10) : fallback;
+  }
+
+ private:
+  std::string space;
+
+  size_t put(const char* key, const std::string& value) {
+    mock::HostScope host;
+    mock::nvs[space][key] = value;
+    return value.size();
+  }
+  bool get(const char* key, std::string& value) {
+    mock::HostScope host;
+    std::map<std::string, std::string>& entries = mock::nvs[space];
+    std::map<std::string, std::string>::iterator it = entries.find(key);
+    if (it == entries.end()) {
+      return false;
+    }
+    value = it->second;
+    return true;
+  }
+};
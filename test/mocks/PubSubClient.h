@@ -0,0 +1,67 @@
+// PubSubClient mock: a broker that is up when mock::brokerUp is set and records every
+// publish. Each publish costs mock::publishMicros of simulated time (network round trip).
+#pragma once
+
+#include <WiFi.h>
+#include <vector>
+
+namespace mock {
+
+struct Publish {
+  std::string topic;
+  std::string payload;
+  bool retained;
+  uint64_t atMicros;
+};
+
+inline bool brokerUp = false;
+inline uint32_t publishMicros = 2000;
+inline std::vector<Publish> published;
+
+}  // namespace mock
+
+class PubSubClient {
+ public:
+  explicit PubSubClient(Client&) {}
+  PubSubClient& setServer(const char* host, uint16_t port) {
+    mock::HostScope scope;
+    serverHost = host;
+    serverPort = port;
+    return *this;
+  }
+  bool setBufferSize(uint16_t size) {
+    bufferSize = size;
+    return true;
+  }
+  PubSubClient& setSocketTimeout(uint16_t) { return *this; }
+  bool connect(const char*, const char*, const char*, const char*, uint8_t, bool, const char*) {
+    open = mock::brokerUp && !serverHost.empty();
+    return open;
+  }
+  void disconnect() { open = false; }
+  bool connected() {
+    open = open && mock::brokerUp;
+    return open;
+  }
+  bool loop() { return connected(); }
+  bool publish(const char* topic, const char* payload) { return publish(topic, payload, false); }
+  bool publish(const char* topic, const char* payload, bool retained) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), retained);
+  }
+  bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (!connected() || length + strlen(topic) + 7 > bufferSize) {
+      return false;
+    }
+    mock::advanceMicros(mock::publishMicros);
+    mock::HostScope scope;
+    mock::published.push_back({ topic, std::string((const char*)payload, length), retained, mock::nowMicros });
+    return true;
+  }
+
+  std::string serverHost;
+  uint16_t serverPort = 0;
+
+ private:
+  uint16_t bufferSize = 256;
+  bool open = false;
+};
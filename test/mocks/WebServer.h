@@ -0,0 +1,186 @@
+// WebServer mock: requests queued with mock::queueRequest() are dispatched one per
+// handleClient() call (or at once through server.dispatch()), and the last response is kept
+// in mock::response. Responses build a header String like the real server does, so their
+// heap traffic is part of what a test sees.
+#pragma once
+
+#include <WiFi.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define HTTP_UPLOAD_BUFLEN 1436
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+namespace mock {
+
+struct Request {
+  std::string uri;
+  HTTPMethod method;
+  std::map<std::string, std::string> args;
+};
+
+struct Response {
+  int code = 0;
+  std::string contentType;
+  std::string body;
+};
+
+inline Response response;
+inline std::map<std::string, std::string> requestArgs;
+inline HTTPMethod requestMethod = HTTP_GET;
+inline bool clientOpen = false;
+inline std::deque<Request> pendingRequests;
+
+inline void queueRequest(const std::string& uri, HTTPMethod method = HTTP_GET,
+                         const std::map<std::string, std::string>& args = {}) {
+  HostScope host;
+  pendingRequests.push_back({ uri, method, args });
+}
+
+}  // namespace mock
+
+class WebServer {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit WebServer(int) {}
+  void begin() {}
+  void handleClient() {
+    if (mock::pendingRequests.empty()) {
+      mock::clientOpen = false;
+      return;
+    }
+    mock::Request request;
+    {
+      mock::HostScope host;
+      request = mock::pendingRequests.front();
+      mock::pendingRequests.pop_front();
+      mock::requestArgs = request.args;
+      mock::requestMethod = request.method;
+    }
+    mock::clientOpen = true;
+    dispatch(request.uri, request.method);
+  }
+  void on(const String& uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+  void on(const String& uri, HTTPMethod method, THandlerFunction handler) { on(uri, method, handler, nullptr); }
+  void on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload) {
+    mock::HostScope host;
+    routes.push_back({ uri.c_str(), method, handler, upload });
+  }
+  void onNotFound(THandlerFunction handler) { notFound = handler; }
+
+  void send(int code, const char* contentType, const String& content) { respond(code, contentType, content.c_str()); }
+  void send(int code, const char* contentType, const char* content) { respond(code, contentType, content); }
+  void send(int code, const String& contentType, const String& content) { respond(code, contentType.c_str(), content.c_str()); }
+  void send(int code) { respond(code, "text/plain", ""); }
+  void send_P(int code, const char* contentType, const char* content) { respond(code, contentType, content); }
+  void sendHeader(const String&, const String&, bool = false) {}
+  void setContentLength(size_t) {}
+  void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char* content, size_t size) {
+    mock::HostScope host;
+    mock::response.body.append(content, size);
+  }
+
+  String arg(const String& name) {
+    std::map<std::string, std::string>::iterator it = mock::requestArgs.find(name.c_str());
+    return it == mock::requestArgs.end() ? String() : String(it->second.c_str());
+  }
+  bool hasArg(const String& name) { return mock::requestArgs.count(name.c_str()) > 0; }
+  int args() { return mock::requestArgs.size(); }
+  HTTPMethod method() { return mock::requestMethod; }
+  String uri() { return String(currentUri.c_str()); }
+  HTTPUpload& upload() { return currentUpload; }
+  WiFiClient client() { return WiFiClient(mock::clientOpen); }
+
+  // Dispatch to the registered route; false when no route matches
+  bool dispatch(const std::string& uri, HTTPMethod method) {
+    for (size_t i = 0; i < routes.size(); i++) {
+      if (routes[i].uri == uri && (routes[i].method == HTTP_ANY || routes[i].method == method)) {
+        {
+          mock::HostScope host;
+          currentUri = uri;
+        }
+        routes[i].handler();
+        return true;
+      }
+    }
+    if (notFound) {
+      notFound();
+    }
+    return false;
+  }
+
+  // Stream a file through the route's upload handler in HTTP_UPLOAD_BUFLEN chunks
+  bool dispatchUpload(const std::string& uri, const std::string& filename, const std::string& content) {
+    for (size_t i = 0; i < routes.size(); i++) {
+      if (routes[i].uri != uri || !routes[i].upload) {
+        continue;
+      }
+      {
+        mock::HostScope host;
+        currentUri = uri;
+      }
+      currentUpload.filename = filename.c_str();
+      currentUpload.totalSize = 0;
+      currentUpload.status = UPLOAD_FILE_START;
+      currentUpload.currentSize = 0;
+      routes[i].upload();
+      for (size_t pos = 0; pos < content.size(); pos += HTTP_UPLOAD_BUFLEN) {
+        currentUpload.currentSize = std::min(content.size() - pos, (size_t)HTTP_UPLOAD_BUFLEN);
+        memcpy(currentUpload.buf, content.data() + pos, currentUpload.currentSize);
+        currentUpload.totalSize += currentUpload.currentSize;
+        currentUpload.status = UPLOAD_FILE_WRITE;
+        routes[i].upload();
+      }
+      currentUpload.status = UPLOAD_FILE_END;
+      currentUpload.currentSize = 0;
+      routes[i].upload();
+      routes[i].handler();
+      return true;
+    }
+    return false;
+  }
+
+ private:
+  struct Route {
+    std::string uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+    THandlerFunction upload;
+  };
+
+  std::vector<Route> routes;
+  THandlerFunction notFound;
+  std::string currentUri;
+  HTTPUpload currentUpload;
+
+  void respond(int code, const char* contentType, const char* content) {
+    // The real server formats the status line and headers into a String per response
+    String header;
+    header.reserve(128);
+    header = "HTTP/1.1 ";
+    header += code;
+    header += " OK\r\nContent-Type: ";
+    header += contentType;
+    header += "\r\nConnection: close\r\n\r\n";
+    mock::HostScope host;
+    mock::response.code = code;
+    mock::response.contentType = contentType;
+    mock::response.body = content;
+  }
+};
@@ -0,0 +1,92 @@
+// WiFi mock: station connects when mock::wifiAvailable is set, otherwise the firmware falls
+// back to its access point. time() is redirected to a simulated wall clock that starts once
+// configTime() was called and mock::ntpReachable is set.
+#pragma once
+
+#include <Arduino.h>
+#include <time.h>
+
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+#define WIFI_OFF 0
+#define WIFI_STA 1
+#define WIFI_AP 2
+#define WIFI_AP_STA 3
+
+namespace mock {
+
+inline bool wifiAvailable = false;
+inline bool ntpReachable = false;
+inline bool modemSleep = false;
+inline bool ntpConfigured = false;
+inline time_t wallClockAtBoot = 1767225600;   // 2026-01-01
+
+inline time_t wallTime(time_t* out) {
+  time_t now = ntpConfigured && ntpReachable ? wallClockAtBoot + (time_t)(nowMicros / 1000000) : (time_t)(nowMicros / 1000000);
+  if (out) {
+    *out = now;
+  }
+  return now;
+}
+
+}  // namespace mock
+
+#define time(out) mock::wallTime(out)
+
+inline void configTime(long, int, const char*, const char* = nullptr, const char* = nullptr) {
+  mock::ntpConfigured = true;
+}
+
+class IPAddress : public Printable {
+ public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : bytes{ a, b, c, d } {}
+  String toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return String(text);
+  }
+  size_t printTo(Print& p) const override { return p.print(toString()); }
+
+ private:
+  uint8_t bytes[4];
+};
+
+class Client : public Stream {
+ public:
+  virtual int connect(const char*, uint16_t) { return 0; }
+  virtual uint8_t connected() { return 0; }
+  virtual void stop() {}
+};
+
+class WiFiClient : public Client {
+ public:
+  explicit WiFiClient(bool open = false) : open(open) {}
+  uint8_t connected() override { return open; }
+  operator bool() { return open; }
+
+ private:
+  bool open;
+};
+
+class WiFiClass {
+ public:
+  void mode(int newMode) { currentMode = newMode; }
+  int getMode() { return currentMode; }
+  void begin(const char* newSsid, const char*) { ssid = newSsid; }
+  int status() { return (currentMode & WIFI_STA) && mock::wifiAvailable ? WL_CONNECTED : WL_DISCONNECTED; }
+  String SSID() { return ssid; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+  IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+  bool softAP(const char*, const char*) { return true; }
+  bool setSleep(bool enable) {
+    mock::modemSleep = enable;
+    return true;
+  }
+
+ private:
+  int currentMode = WIFI_OFF;
+  String ssid;
+};
+
+inline WiFiClass WiFi;
@@ -0,0 +1,35 @@
+// GPIO driver mock: records which pins are armed as light-sleep wakeup sources and which have
+// their interrupt masked
+#pragma once
+
+#include <Arduino.h>
+
+typedef int gpio_num_t;
+typedef enum { GPIO_INTR_DISABLE, GPIO_INTR_POSEDGE, GPIO_INTR_NEGEDGE, GPIO_INTR_ANYEDGE, GPIO_INTR_LOW_LEVEL, GPIO_INTR_HIGH_LEVEL } gpio_int_type_t;
+
+namespace mock {
+
+inline bool gpioWakeup[40] = { false };
+inline bool gpioIntrDisabled[40] = { false };
+
+}  // namespace mock
+
+inline int gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t) {
+  mock::gpioWakeup[pin] = true;
+  return 0;
+}
+
+inline int gpio_wakeup_disable(gpio_num_t pin) {
+  mock::gpioWakeup[pin] = false;
+  return 0;
+}
+
+inline int gpio_intr_disable(gpio_num_t pin) {
+  mock::gpioIntrDisabled[pin] = true;
+  return 0;
+}
+
+inline int gpio_intr_enable(gpio_num_t pin) {
+  mock::gpioIntrDisabled[pin] = false;
+  return 0;
+}
@@ -0,0 +1,47 @@
+// Heap capabilities mock. Without a test heap installed it reports a fixed healthy heap;
+// a test installs mock::heapInfo to report its heap model instead.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+typedef struct {
+  size_t total_free_bytes;
+  size_t total_allocated_bytes;
+  size_t largest_free_block;
+  size_t minimum_free_bytes;
+  size_t allocated_blocks;
+  size_t free_blocks;
+  size_t total_blocks;
+} multi_heap_info_t;
+
+typedef void (*esp_alloc_failed_hook_t)(size_t size, uint32_t caps, const char* function_name);
+
+namespace mock {
+
+inline void (*heapInfo)(multi_heap_info_t*) = nullptr;
+inline esp_alloc_failed_hook_t allocFailedHook = nullptr;
+
+}  // namespace mock
+
+inline void heap_caps_get_info(multi_heap_info_t* info, uint32_t) {
+  if (mock::heapInfo) {
+    mock::heapInfo(info);
+    return;
+  }
+  *info = { 180000, 120000, 110000, 160000, 900, 12, 912 };
+}
+
+inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, caps);
+  return info.largest_free_block;
+}
+
+inline int heap_caps_register_failed_alloc_callback(esp_alloc_failed_hook_t hook) {
+  mock::allocFailedHook = hook;
+  return 0;
+}
@@ -0,0 +1,48 @@
+// Power management mock: records the configuration and counts held no-light-sleep locks
+#pragma once
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#endif
+
+typedef enum { ESP_PM_CPU_FREQ_MAX, ESP_PM_APB_FREQ_MAX, ESP_PM_NO_LIGHT_SLEEP } esp_pm_lock_type_t;
+
+typedef struct {
+  int max_freq_mhz;
+  int min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+typedef int* esp_pm_lock_handle_t;
+
+namespace mock {
+
+inline esp_pm_config_esp32_t pmConfig = {};
+inline bool pmConfigured = false;
+inline int noLightSleepLocks = 0;
+
+}  // namespace mock
+
+inline esp_err_t esp_pm_configure(const void* config) {
+  mock::pmConfig = *(const esp_pm_config_esp32_t*)config;
+  mock::pmConfigured = true;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_create(esp_pm_lock_type_t, int, const char*, esp_pm_lock_handle_t* handle) {
+  *handle = &mock::noLightSleepLocks;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) {
+  (*handle)++;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) {
+  (*handle)--;
+  return ESP_OK;
+}
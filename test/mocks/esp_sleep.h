@@ -0,0 +1,20 @@
+// Sleep mock: light sleep returns at once with the wakeup cause a test put in mock::wakeupCause
+#pragma once
+
+#include <Arduino.h>
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED, ESP_SLEEP_WAKEUP_ALL, ESP_SLEEP_WAKEUP_EXT0, ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER, ESP_SLEEP_WAKEUP_TOUCHPAD, ESP_SLEEP_WAKEUP_ULP, ESP_SLEEP_WAKEUP_GPIO
+} esp_sleep_wakeup_cause_t;
+
+namespace mock {
+
+inline esp_sleep_wakeup_cause_t wakeupCause = ESP_SLEEP_WAKEUP_TIMER;
+
+}  // namespace mock
+
+inline int esp_sleep_enable_timer_wakeup(uint64_t) { return 0; }
+inline int esp_sleep_enable_gpio_wakeup() { return 0; }
+inline int esp_light_sleep_start() { return 0; }
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return mock::wakeupCause; }
@@ -0,0 +1,6 @@
+// esp_timer mock on the simulated clock
+#pragma once
+
+#include <Arduino.h>
+
+inline int64_t esp_timer_get_time() { return mock::nowMicros; }
@@ -0,0 +1,141 @@
+// Single-threaded FreeRTOS mock: queues are FIFOs, tasks are recorded but never run, and a
+// blocking wait advances the simulated clock through mock::idle (tests can replace it to
+// deliver events in the middle of a wait).
+#pragma once
+
+#include <deque>
+#include <vector>
+
+typedef void* QueueHandle_t;
+typedef void* TaskHandle_t;
+typedef void* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void*);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errQUEUE_FULL 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR(...) ((void)0)
+
+namespace mock {
+
+struct Queue {
+  size_t itemSize;
+  size_t length;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+inline uint32_t notifyCount = 0;
+
+// Called when a blocking call would wait; returns once the wait is over
+inline void (*idle)(TickType_t ticks) = [](TickType_t ticks) { advanceMillis(ticks); };
+
+inline void wait(TickType_t ticks) {
+  if (ticks > 0 && ticks != portMAX_DELAY) {
+    idle(ticks);
+  }
+}
+
+}  // namespace mock
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  mock::HostScope host;
+  return new mock::Queue{ itemSize, length, {} };
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t) {
+  mock::HostScope host;
+  mock::Queue* queue = (mock::Queue*)handle;
+  if (queue->items.size() >= queue->length) {
+    return errQUEUE_FULL;
+  }
+  const uint8_t* bytes = (const uint8_t*)item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void* item, BaseType_t*) {
+  return xQueueSend(handle, item, 0);
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t ticks) {
+  mock::Queue* queue = (mock::Queue*)handle;
+  if (queue->items.empty()) {
+    mock::wait(ticks);
+  }
+  if (queue->items.empty()) {
+    return pdFALSE;
+  }
+  mock::HostScope host;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+  return ((mock::Queue*)handle)->items.size();
+}
+
+inline UBaseType_t uxQueueSpacesAvailable(QueueHandle_t handle) {
+  mock::Queue* queue = (mock::Queue*)handle;
+  return queue->length - queue->items.size();
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t,
+                                          TaskHandle_t* handle, BaseType_t) {
+  if (handle) {
+    *handle = (TaskHandle_t)1;
+  }
+  return pdPASS;
+}
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return (TaskHandle_t)1; }
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t* woken) {
+  mock::notifyCount++;
+  if (woken) {
+    *woken = pdTRUE;
+  }
+}
+
+inline void xTaskNotifyGive(TaskHandle_t) { mock::notifyCount++; }
+
+inline uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  if (mock::notifyCount == 0) {
+    mock::wait(ticks);
+  }
+  uint32_t count = mock::notifyCount;
+  mock::notifyCount = clearOnExit ? 0 : (count > 0 ? count - 1 : 0);
+  return count;
+}
+
+inline void vTaskDelay(TickType_t ticks) { mock::wait(ticks); }
+inline TickType_t xTaskGetTickCount() { return millis(); }
+
+// Mutexes: single-threaded, so taking one only checks it is not already held
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+  mock::HostScope host;
+  return new int(0);
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t) {
+  int* held = (int*)handle;
+  if (*held) {
+    return pdFALSE;
+  }
+  *held = 1;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+  *(int*)handle = 0;
+  return pdTRUE;
+}
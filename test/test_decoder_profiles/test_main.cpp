@@ -0,0 +1,219 @@
+// Decoder profile test: replays a living-room protocol mix through decodeWithProfile() and
+// reports decoder attempts per frame, which is measured, and decode time per frame, which is
+// modelled: the mock decoders cost mock::decodeAttemptMicros per attempt, so it only restates
+// the attempt count in microseconds. Real decoder time is in /decoders on the device. Run it
+// once per build profile (pio test -e native, native_tv, native_nec) to compare the profiles;
+// tools/profile_sizes.sh compares their flash size.
+#include "main.cpp"
+
+#include <unity.h>
+
+const uint32_t REPLAY_FRAMES = 2000;
+
+// Protocol mix of a TV setup: mostly the Samsung TV remote, a NEC soundbar, a Sony player and
+// the odd frame from a remote nobody has a decoder for
+static mock::IrFrame capturedFrame(uint32_t i) {
+  uint32_t slot = (i * 37) % 100;
+  if (slot < 65) {
+    return { SAMSUNG, 0x0707, (uint16_t)(i % 12), 0 };
+  }
+  if (slot < 85) {
+    return { NEC, 0x04, (uint16_t)(i % 6), 0 };
+  }
+  if (slot < 95) {
+    return { SONY, 0x01, (uint16_t)(i % 4), 0 };
+  }
+  return { UNKNOWN, 0x00, (uint16_t)i, 0 };
+}
+
+struct ReplayResult {
+  double attemptsPerFrame;
+  double microsPerFrame;                     // modelled, attempts x mock::decodeAttemptMicros
+  double decodedPercent;                     // frames a protocol decoder recognised
+};
+
+static void resetDecoders() {
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    decoders[i].attempts = 0;
+    decoders[i].hits = 0;
+    decoders[i].recentHits = 0;
+    decoders[i].micros = 0;
+  }
+  decodeMicros = {};
+  decodesSinceReorder = 0;
+  loadDecoderProfile();
+}
+
+static ReplayResult replay(uint32_t frames) {
+  uint32_t attemptsBefore = mock::decodeAttempts;
+  uint64_t startMicros = mock::nowMicros;
+  uint32_t decoded = 0;
+  for (uint32_t i = 0; i < frames; i++) {
+    mock::receiveFrame(capturedFrame(i));
+    decodeWithProfile();
+    if (IrReceiver.decodedIRData.protocol != UNKNOWN) {
+      decoded++;
+    }
+    IrReceiver.resume();
+  }
+  return { (double)(mock::decodeAttempts - attemptsBefore) / frames,
+           (double)(mock::nowMicros - startMicros) / frames, 100.0 * decoded / frames };
+}
+
+static void report(const char* what, const ReplayResult& result) {
+  char message[200];
+  snprintf(message, sizeof(message),
+           "profile %s, %d decoders, %s: %.2f attempts per frame (modelled %.1f us at %u us per attempt), %.0f%% decoded",
+           decoderProfileName(), DECODER_COUNT, what, result.attemptsPerFrame, result.microsPerFrame,
+           (unsigned)mock::decodeAttemptMicros, result.decodedPercent);
+  TEST_MESSAGE(message);
+}
+
+// Attempts per frame the fixed table order would cost, for the enabled decoders
+static double tableOrderAttempts(uint32_t frames) {
+  uint32_t attempts = 0;
+  for (uint32_t i = 0; i < frames; i++) {
+    decode_type_t protocol = capturedFrame(i).protocol;
+    for (int d = 0; d < DECODER_COUNT; d++) {
+      if (!(decoderMask & bit(d))) {
+        continue;
+      }
+      attempts++;
+      String name = decoders[d].name;
+      if ((name == "Samsung" && protocol == SAMSUNG) || (name == "NEC" && protocol == NEC) ||
+          (name == "Sony" && protocol == SONY) || name == "Hash") {
+        break;
+      }
+    }
+  }
+  return (double)attempts / frames;
+}
+
+static bool savedEnabled(String* names) {
+  if (mock::nvs["decoders"].count("enabled") == 0) {
+    return false;
+  }
+  *names = mock::nvs["decoders"]["enabled"].c_str();
+  return true;
+}
+
+static void postEnabled(const char* list) {
+  mock::requestArgs = { { "enabled", list } };
+  mock::requestMethod = HTTP_POST;
+  server.dispatch("/decoders", HTTP_POST);
+  mock::requestArgs.clear();
+  mock::requestMethod = HTTP_GET;
+}
+
+void setUp() {
+  static bool booted = false;
+  if (!booted) {
+    booted = true;
+    setup();
+  }
+  mock::nvs["decoders"].clear();
+  resetDecoders();
+}
+
+void tearDown() {}
+
+// The learned priority order must not cost more than the table order once it has adapted
+void test_replay_learned_order() {
+  double tableAttempts = tableOrderAttempts(REPLAY_FRAMES);
+  replay(REPLAY_FRAMES / 4);
+  ReplayResult learned = replay(REPLAY_FRAMES);
+  report("learned order", learned);
+  TEST_ASSERT_TRUE(learned.attemptsPerFrame <= tableAttempts);
+  TEST_ASSERT_EQUAL_UINT32(REPLAY_FRAMES * 5 / 4, decodeMicros.count);
+}
+
+#if defined(DECODE_SAMSUNG) && defined(DECODE_SONY)
+// Hit counts age, so the order follows a change of remote instead of months of history
+void test_order_follows_new_remote() {
+  int samsung = 0;
+  int sony = 0;
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    if (String(decoders[i].name) == "Samsung") {
+      samsung = i;
+    } else if (String(decoders[i].name) == "Sony") {
+      sony = i;
+    }
+  }
+  for (uint32_t i = 0; i < 20000; i++) {
+    mock::receiveFrame({ SAMSUNG, 0x0707, 0x02, 0 });
+    decodeWithProfile();
+    IrReceiver.resume();
+  }
+  TEST_ASSERT_EQUAL_INT(samsung, decoderOrder[0]);
+  for (uint32_t i = 0; i < 4 * DECODER_REORDER_INTERVAL; i++) {
+    mock::receiveFrame({ SONY, 0x01, 0x15, 0 });
+    decodeWithProfile();
+    IrReceiver.resume();
+  }
+  TEST_ASSERT_EQUAL_INT(sony, decoderOrder[0]);
+  TEST_ASSERT_EQUAL_UINT32(20000, decoders[samsung].hits);
+}
+#endif
+
+// Enabling only the remotes in use shortens the search for frames nothing decodes
+void test_replay_enabled_subset() {
+  ReplayResult all = replay(REPLAY_FRAMES);
+  report("all enabled", all);
+
+  postEnabled("Samsung, NEC, Sony, Hash");
+  TEST_ASSERT_TRUE(mock::response.body.find("\"success\":true") != std::string::npos);
+  resetDecoders();
+  ReplayResult subset = replay(REPLAY_FRAMES);
+  report("Samsung, NEC, Sony, Hash", subset);
+  TEST_ASSERT_TRUE(subset.microsPerFrame <= all.microsPerFrame);
+  TEST_ASSERT_TRUE(subset.attemptsPerFrame <= all.attemptsPerFrame);
+}
+
+// The saved list is decoder names, so it means the same decoders under every build profile
+void test_saved_names_follow_profile() {
+  mock::nvs["decoders"]["enabled"] = "Sony,NEC,MagiQuest,NoSuchDecoder";
+  loadDecoderProfile();
+  for (int i = 0; i < DECODER_COUNT; i++) {
+    String name = decoders[i].name;
+    bool listed = name == "Sony" || name == "NEC" || name == "MagiQuest";
+    TEST_ASSERT_EQUAL_MESSAGE(listed, (decoderMask & bit(i)) != 0, decoders[i].name);
+  }
+
+  // A list with nothing built into this profile falls back to all decoders
+  mock::nvs["decoders"]["enabled"] = "NoSuchDecoder";
+  loadDecoderProfile();
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, decoderMask);
+}
+
+// POST saves the canonical names and drops the old bit mask key
+void test_post_saves_names() {
+  mock::nvs["decoders"]["mask"] = "1";
+  postEnabled("NEC");
+  String names;
+  TEST_ASSERT_TRUE(savedEnabled(&names));
+  TEST_ASSERT_EQUAL_STRING("NEC", names.c_str());
+  TEST_ASSERT_EQUAL(0, mock::nvs["decoders"].count("mask"));
+  uint32_t mask = decoderMask;
+  loadDecoderProfile();
+  TEST_ASSERT_EQUAL_UINT32(mask, decoderMask);
+
+  // Empty enables all, including decoders of other profiles after a reflash
+  postEnabled("");
+  TEST_ASSERT_FALSE(savedEnabled(&names));
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, decoderMask);
+
+  postEnabled("NoSuchDecoder");
+  TEST_ASSERT_TRUE(mock::response.body.find("\"success\":false") != std::string::npos);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_learned_order);
+  RUN_TEST(test_replay_enabled_subset);
+#if defined(DECODE_SAMSUNG) && defined(DECODE_SONY)
+  RUN_TEST(test_order_follows_new_remote);
+#endif
+  RUN_TEST(test_saved_names_follow_profile);
+  RUN_TEST(test_post_saves_names);
+  return UNITY_END();
+}
@@ -0,0 +1,167 @@
+// First-fit model of the ESP32 data heap: one arena, 8-byte aligned blocks with an 8-byte
+// header, split on allocation and coalesced with free neighbours. Small enough to reason
+// about, and pessimistic compared to the TLSF allocator in ESP-IDF.
+#pragma once
+
+#include <esp_heap_caps.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+class HeapModel {
+ public:
+  explicit HeapModel(size_t size) : capacity(size & ~(size_t)7) {
+    arena = (uint8_t*)malloc(capacity);
+    reset();
+  }
+  ~HeapModel() { free(arena); }
+
+  void reset() {
+    Block* first = (Block*)arena;
+    first->size = capacity;
+    first->used = 0;
+    allocatedBytes = 0;
+    minimumFree = capacity;
+    failures = 0;
+    allocations = 0;
+    largestRequest = 0;
+  }
+
+  bool owns(const void* ptr) const { return ptr >= arena && ptr < arena + capacity; }
+
+  void* allocate(size_t size) {
+    allocations++;
+    largestRequest = size > largestRequest ? size : largestRequest;
+    size_t need = blockSizeFor(size);
+    for (uint8_t* p = arena; p < arena + capacity; p += ((Block*)p)->size) {
+      Block* block = (Block*)p;
+      if (block->used) {
+        continue;
+      }
+      mergeFollowing(block);
+      if (block->size >= need) {
+        split(block, need);
+        block->used = 1;
+        allocatedBytes += block->size;
+        minimumFree = capacity - allocatedBytes < minimumFree ? capacity - allocatedBytes : minimumFree;
+        return p + HEADER;
+      }
+    }
+    failures++;
+    if (mock::allocFailedHook) {
+      mock::allocFailedHook(size, MALLOC_CAP_8BIT, "heap_model");
+    }
+    return nullptr;
+  }
+
+  void release(void* ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    Block* block = headerOf(ptr);
+    block->used = 0;
+    allocatedBytes -= block->size;
+    mergeFollowing(block);
+  }
+
+  void* reallocate(void* ptr, size_t size) {
+    if (ptr == nullptr) {
+      return allocate(size);
+    }
+    Block* block = headerOf(ptr);
+    size_t need = blockSizeFor(size);
+    if (block->size >= need) {
+      return ptr;
+    }
+    // Grow in place into a free neighbour, as multi_heap does
+    Block* next = nextOf(block);
+    if (next != nullptr && !next->used) {
+      mergeFollowing(next);
+      if (block->size + next->size >= need) {
+        size_t before = block->size;
+        block->size += next->size;
+        split(block, need);
+        allocatedBytes += block->size - before;
+        minimumFree = capacity - allocatedBytes < minimumFree ? capacity - allocatedBytes : minimumFree;
+        return ptr;
+      }
+    }
+    void* moved = allocate(size);
+    if (moved == nullptr) {
+      return nullptr;
+    }
+    memcpy(moved, ptr, block->size - HEADER);
+    release(ptr);
+    return moved;
+  }
+
+  void info(multi_heap_info_t* out) const {
+    memset(out, 0, sizeof(*out));
+    size_t run = 0;
+    for (uint8_t* p = arena; p < arena + capacity; p += ((Block*)p)->size) {
+      Block* block = (Block*)p;
+      if (block->used) {
+        out->allocated_blocks++;
+        out->total_allocated_bytes += block->size - HEADER;
+        run = 0;
+        continue;
+      }
+      // Adjacent free blocks not merged yet still count as one free region
+      if (run == 0) {
+        out->free_blocks++;
+      }
+      run += block->size;
+      out->total_free_bytes += block->size;
+      out->largest_free_block = run - HEADER > out->largest_free_block ? run - HEADER : out->largest_free_block;
+    }
+    out->total_blocks = out->allocated_blocks + out->free_blocks;
+    out->minimum_free_bytes = minimumFree;
+  }
+
+  size_t failures = 0;
+  size_t allocations = 0;
+  size_t largestRequest = 0;
+
+ private:
+  struct Block {
+    uint32_t size;                           // including the header
+    uint32_t used;
+  };
+
+  static const size_t HEADER = sizeof(Block);
+  static const size_t MIN_BLOCK = 16;
+
+  uint8_t* arena;
+  size_t capacity;
+  size_t allocatedBytes = 0;
+  size_t minimumFree = 0;
+
+  static size_t blockSizeFor(size_t size) {
+    size_t need = ((size + 7) & ~(size_t)7) + HEADER;
+    return need < MIN_BLOCK ? MIN_BLOCK : need;
+  }
+
+  static Block* headerOf(void* ptr) { return (Block*)((uint8_t*)ptr - HEADER); }
+
+  Block* nextOf(Block* block) const {
+    uint8_t* next = (uint8_t*)block + block->size;
+    return next < arena + capacity ? (Block*)next : nullptr;
+  }
+
+  void mergeFollowing(Block* block) {
+    Block* next;
+    while ((next = nextOf(block)) != nullptr && !next->used) {
+      block->size += next->size;
+    }
+  }
+
+  void split(Block* block, size_t need) {
+    if (block->size - need < MIN_BLOCK) {
+      return;
+    }
+    Block* rest = (Block*)((uint8_t*)block + need);
+    rest->size = block->size - need;
+    rest->used = 0;
+    block->size = need;
+  }
+};
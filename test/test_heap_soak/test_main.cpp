@@ -0,0 +1,284 @@
+// Heap soak test: boots the firmware on the host mocks, then runs simulated days of remote
+// presses, web UI polling and command exports through loop() with every device allocation
+// served by a first-fit heap model. Fails when the largest free block shrinks or the heap
+// fragments over time, which is what eventually breaks a device that stays up for weeks.
+#include "main.cpp"
+
+#include <unity.h>
+#include <new>
+
+#include "heap_model.h"
+
+// Room left for the firmware once WiFi, lwIP and the web server have taken theirs
+const size_t SOAK_HEAP_BYTES = 96 * 1024;
+const int SOAK_DAYS = 7;
+const uint32_t FRAMES_PER_DAY = 600;
+const uint32_t UI_SESSION_MS = 2UL * 3600 * 1000;   // web UI left open two hours a day
+const uint32_t UI_POLL_MS = 500;                     // same interval as the page's /data poll
+const uint64_t DAY_MS = 24ULL * 3600 * 1000;
+
+HeapModel* soakHeap = nullptr;
+
+// Device allocations (outside a mock::HostScope) come from the model while it is installed
+static bool deviceAllocation() {
+  return soakHeap != nullptr && mock::hostScope == 0;
+}
+
+static void* soakRealloc(void* ptr, size_t size) {
+  if (ptr != nullptr ? soakHeap->owns(ptr) : deviceAllocation()) {
+    return soakHeap->reallocate(ptr, size);
+  }
+  return realloc(ptr, size);
+}
+
+static void soakFree(void* ptr) {
+  if (soakHeap != nullptr && soakHeap->owns(ptr)) {
+    soakHeap->release(ptr);
+  } else {
+    free(ptr);
+  }
+}
+
+static void soakHeapInfo(multi_heap_info_t* info) {
+  soakHeap->info(info);
+}
+
+void* operator new(size_t size) {
+  void* ptr = deviceAllocation() ? soakHeap->allocate(size) : malloc(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { soakFree(ptr); }
+void operator delete[](void* ptr) noexcept { soakFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { soakFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { soakFree(ptr); }
+
+// Simulated day: scheduled remote presses and web requests, delivered from the idle hook
+struct SoakEvent {
+  uint64_t atMs;
+  bool ir;
+  mock::IrFrame frame;
+  std::string uri;
+  std::map<std::string, std::string> args;
+};
+
+std::vector<SoakEvent> schedule;
+size_t nextEvent = 0;
+uint32_t rng = 12345;
+
+static uint32_t nextRandom() {
+  rng = rng * 1103515245u + 12345u;
+  return rng >> 8;
+}
+
+static const mock::IrFrame REMOTE_KEYS[] = {
+  { NEC, 0x04, 0x08, 0 }, { NEC, 0x04, 0x02, 0 }, { NEC, 0x04, 0x02, IRDATA_FLAGS_IS_REPEAT },
+  { SAMSUNG, 0x0707, 0x02, 0 }, { SAMSUNG, 0x0707, 0x07, 0 }, { SONY, 0x01, 0x12, 0 },
+  { RC5, 0x00, 0x0C, 0 }, { UNKNOWN, 0x00, 0x5A, 0 },
+};
+
+static void addRequest(uint64_t atMs, const std::string& uri, const std::map<std::string, std::string>& args = {}) {
+  schedule.push_back({ atMs, false, {}, uri, args });
+}
+
+static void planDay(uint64_t dayStart, int day) {
+  mock::HostScope host;
+  schedule.clear();
+  nextEvent = 0;
+  for (uint32_t i = 0; i < FRAMES_PER_DAY; i++) {
+    const mock::IrFrame& key = REMOTE_KEYS[nextRandom() % (sizeof(REMOTE_KEYS) / sizeof(REMOTE_KEYS[0]))];
+    schedule.push_back({ dayStart + nextRandom() % DAY_MS, true, key, "", {} });
+  }
+  uint64_t uiStart = dayStart + 19ULL * 3600 * 1000;
+  for (uint64_t t = uiStart; t < uiStart + UI_SESSION_MS; t += UI_POLL_MS) {
+    addRequest(t, "/data");
+  }
+  // A few saves with labels of varying length while the UI is open, then the rare pages
+  for (int i = 0; i < 8; i++) {
+    addRequest(uiStart + 60000 + i * 431000 + 250, "/save", { { "label", std::string(4 + (nextRandom() % 20), 'k') } });
+  }
+  addRequest(uiStart + 1800000 + 250, "/stats");
+  addRequest(uiStart + 1900000 + 250, "/heap");
+  addRequest(uiStart + 2000000 + 250, "/history", { { "limit", "32" } });
+  addRequest(uiStart + 2100000 + 250, "/commands", { { "limit", "20" } });
+  addRequest(uiStart + 2200000 + 250, "/timeseries");
+  addRequest(uiStart + UI_SESSION_MS - 60000 + 250, "/download");
+  if (day % 3 == 2) {
+    addRequest(uiStart + UI_SESSION_MS - 30000 + 250, "/clear");
+  }
+  std::sort(schedule.begin(), schedule.end(),
+            [](const SoakEvent& a, const SoakEvent& b) { return a.atMs < b.atMs; });
+}
+
+// Blocking waits in loop() end here: run the clock forward, delivering events on the way.
+// A remote press fires the receiver interrupt and ends the wait, as it does on the device.
+static void soakIdle(TickType_t ticks) {
+  uint64_t until = mock::nowMicros + (uint64_t)ticks * 1000;
+  while (nextEvent < schedule.size() && schedule[nextEvent].atMs * 1000 <= until) {
+    const SoakEvent& event = schedule[nextEvent++];
+    if (event.atMs * 1000 > mock::nowMicros) {
+      mock::nowMicros = event.atMs * 1000;
+    }
+    if (event.ir) {
+      mock::receiveFrame(event.frame);
+      return;
+    }
+    mock::queueRequest(event.uri, HTTP_GET, event.args);
+  }
+  mock::nowMicros = until;
+}
+
+static void runUntil(uint64_t endMs) {
+  while (millis() < endMs) {
+    loop();
+  }
+}
+
+static multi_heap_info_t heapNow() {
+  multi_heap_info_t info;
+  heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+  return info;
+}
+
+// Same measure as /heap reports: share of free memory outside the largest free block
+static unsigned fragmentationPercent(const multi_heap_info_t& info) {
+  return info.total_free_bytes > 0 ? 100 - info.largest_free_block * 100 / info.total_free_bytes : 0;
+}
+
+static void bootOnce() {
+  static bool booted = false;
+  if (booted) {
+    return;
+  }
+  booted = true;
+  {
+    mock::HostScope host;
+    soakHeap = new HeapModel(SOAK_HEAP_BYTES);
+  }
+  mock::heapRealloc = soakRealloc;
+  mock::heapFree = soakFree;
+  mock::heapInfo = soakHeapInfo;
+  mock::idle = soakIdle;
+  setup();
+}
+
+void setUp() {
+  bootOnce();
+}
+
+void tearDown() {}
+
+// Boot must leave most of the heap in one piece
+void test_boot_leaves_contiguous_heap() {
+  multi_heap_info_t info = heapNow();
+  TEST_ASSERT_EQUAL_UINT32(0, soakHeap->failures);
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_HEAP_BYTES * 3 / 4, info.largest_free_block);
+}
+
+// Days of normal use: the largest free block must hold up and nothing may leak
+void test_soak_days_keep_largest_block() {
+  uint64_t start = millis();
+  size_t baselineLargest = 0;
+  size_t baselineAllocated = 0;
+  size_t worstLargest = SOAK_HEAP_BYTES;
+  for (int day = 0; day < SOAK_DAYS; day++) {
+    uint64_t dayStart = start + day * DAY_MS;
+    planDay(dayStart, day);
+    runUntil(dayStart + DAY_MS);
+    multi_heap_info_t info = heapNow();
+    worstLargest = std::min(worstLargest, info.largest_free_block);
+    if (day == 0) {
+      baselineLargest = info.largest_free_block;
+      baselineAllocated = info.total_allocated_bytes;
+    }
+    char message[160];
+    snprintf(message, sizeof(message), "day %d: free %u, largest %u, fragmentation %u%%, allocated %u in %u blocks",
+             day + 1, (unsigned)info.total_free_bytes, (unsigned)info.largest_free_block,
+             fragmentationPercent(info), (unsigned)info.total_allocated_bytes,
+             (unsigned)info.allocated_blocks);
+    TEST_MESSAGE(message);
+  }
+  multi_heap_info_t info = heapNow();
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_DAYS * FRAMES_PER_DAY * 9 / 10, signalCount);
+  TEST_ASSERT_EQUAL_UINT32(0, soakHeap->failures);
+  TEST_ASSERT_GREATER_OR_EQUAL(baselineLargest * 9 / 10, info.largest_free_block);
+  TEST_ASSERT_GREATER_OR_EQUAL(SOAK_HEAP_BYTES / 2, worstLargest);
+  TEST_ASSERT_LESS_OR_EQUAL(20, fragmentationPercent(info));
+  // Saved commands come and go with /clear, so allow one full list worth of drift
+  TEST_ASSERT_LESS_OR_EQUAL(baselineAllocated + MAX_SAVED_COMMANDS * 160, info.total_allocated_bytes);
+}
+
+// The export is streamed per command: no allocation may scale with the number of commands
+void test_download_streams_without_large_blocks() {
+  uint64_t now = millis();
+  {
+    mock::HostScope host;
+    schedule.clear();
+    nextEvent = 0;
+    for (size_t i = savedCommands.size(); i < MAX_SAVED_COMMANDS; i++) {
+      SoakEvent press = { now + 1000 + i * 2000, true, REMOTE_KEYS[i % 4], "", {} };
+      schedule.push_back(press);
+      addRequest(now + 1500 + i * 2000, "/save", { { "label", std::string(23, 'x') } });
+    }
+  }
+  runUntil(now + 1000 + MAX_SAVED_COMMANDS * 2000 + 1000);
+  TEST_ASSERT_EQUAL_UINT32(MAX_SAVED_COMMANDS, savedCommands.size());
+
+  soakHeap->largestRequest = 0;
+  size_t before = soakHeap->allocations;
+  server.dispatch("/download", HTTP_GET);
+  TEST_ASSERT_LESS_OR_EQUAL(1024, soakHeap->largestRequest);
+  TEST_ASSERT_GREATER_THAN(MAX_SAVED_COMMANDS * 150, mock::response.body.size());
+  char message[96];
+  snprintf(message, sizeof(message), "/download: %u allocations, largest %u bytes",
+           (unsigned)(soakHeap->allocations - before), (unsigned)soakHeap->largestRequest);
+  TEST_MESSAGE(message);
+}
+
+// A full /commands page is streamed like the export; limit=0 is an error, not the maximum
+void test_commands_page_streams_without_large_blocks() {
+  soakHeap->largestRequest = 0;
+  mock::requestArgs = { { "limit", "100" } };
+  server.dispatch("/commands", HTTP_GET);
+  TEST_ASSERT_LESS_OR_EQUAL(1024, soakHeap->largestRequest);
+  TEST_ASSERT_EQUAL(200, mock::response.code);
+  const std::string& body = mock::response.body;
+  TEST_ASSERT_EQUAL(0, body.find("{\"total\":" + std::to_string(MAX_SAVED_COMMANDS) + ",\"offset\":0,\"limit\":100,"));
+  TEST_ASSERT_EQUAL('}', body.back());
+
+  mock::requestArgs = { { "limit", "5" }, { "offset", "48" } };
+  server.dispatch("/commands", HTTP_GET);
+  size_t items = 0;
+  for (size_t pos = mock::response.body.find("{\"id\":"); pos != std::string::npos;
+       pos = mock::response.body.find("{\"id\":", pos + 1)) {
+    items++;
+  }
+  TEST_ASSERT_EQUAL(2, items);
+
+  mock::requestArgs = { { "limit", "0" } };
+  server.dispatch("/commands", HTTP_GET);
+  mock::requestArgs.clear();
+  TEST_ASSERT_EQUAL(400, mock::response.code);
+}
+
+// The page polls /data twice a second: one reserved buffer plus the server's own header
+void test_data_poll_allocations_bounded() {
+  size_t before = soakHeap->allocations;
+  server.dispatch("/data", HTTP_GET);
+  TEST_ASSERT_LESS_OR_EQUAL(3, soakHeap->allocations - before);
+  TEST_ASSERT_EQUAL_STRING("application/json", mock::response.contentType.c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_boot_leaves_contiguous_heap);
+  RUN_TEST(test_soak_days_keep_largest_block);
+  RUN_TEST(test_download_streams_without_large_blocks);
+  RUN_TEST(test_commands_page_streams_without_large_blocks);
+  RUN_TEST(test_data_poll_allocations_bounded);
+  return UNITY_END();
+}
@@ -0,0 +1,234 @@
+// Code library import test: parsing rules of the import formats, the sorted index kept by
+// batch merges, heap-capped index sizing, library labels resolved by the MQTT task and the
+// import rate of large libraries.
+#include <chrono>
+
+#include "main.cpp"
+
+#include <unity.h>
+
+struct ImportResult {
+  uint32_t imported;
+  uint32_t invalid;
+  uint32_t duplicates;
+  uint32_t rejected;
+};
+
+static ImportResult importFile(const std::string& filename, const std::string& content) {
+  server.dispatchUpload("/import", filename, content);
+  return { importState.imported, importState.invalid, importState.duplicates, importState.rejected };
+}
+
+static bool inLibrary(const char* protocol, uint16_t address, uint16_t command, String* label = nullptr) {
+  LibraryRecord record;
+  if (!findLibraryRecord(protocol, address, command, &record)) {
+    return false;
+  }
+  if (label) {
+    *label = record.label;
+  }
+  return true;
+}
+
+static bool indexSorted() {
+  for (size_t i = 1; i < libraryIndex.size(); i++) {
+    if (libraryIndex[i - 1].hash > libraryIndex[i].hash) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void setUp() {
+  static bool booted = false;
+  if (!booted) {
+    booted = true;
+    setup();
+  }
+  server.dispatch("/library_clear", HTTP_GET);
+}
+
+void tearDown() {}
+
+// Numbers are decimal or 0x hex; a leading zero is not octal and trailing garbage is invalid
+void test_csv_numbers_are_validated() {
+  ImportResult result = importFile("codes.csv",
+                                   "protocol,address,command,label\n"
+                                   "NEC,08,0x10,eight\n"
+                                   "NEC,0x4,12abc,garbage\n"
+                                   "NEC,zz,1,letters\n"
+                                   "NEC,-1,1,negative\n"
+                                   "NEC,4,,empty\n");
+  TEST_ASSERT_EQUAL_UINT32(1, result.imported);
+  TEST_ASSERT_EQUAL_UINT32(4, result.invalid);
+  TEST_ASSERT_TRUE(inLibrary("NEC", 8, 0x10));
+}
+
+void test_jsonl_numbers_are_validated() {
+  ImportResult result = importFile("codes.jsonl",
+                                   "{\"protocol\":\"Sony\",\"address\":\"010\",\"command\":18,\"label\":\"ten\"}\n"
+                                   "{\"protocol\":\"Sony\",\"address\":\"0x1\",\"command\":\"0xZZ\"}\n");
+  TEST_ASSERT_EQUAL_UINT32(1, result.imported);
+  TEST_ASSERT_EQUAL_UINT32(1, result.invalid);
+  TEST_ASSERT_TRUE(inLibrary("Sony", 10, 18));
+}
+
+// Flipper's one-byte Samsung address and LIRC's two-byte one describe the same remote
+void test_samsung_address_expanded_like_lirc() {
+  importFile("tv.ir",
+             "Filetype: IR signals file\n"
+             "#\n"
+             "name: Power\n"
+             "type: parsed\n"
+             "protocol: Samsung32\n"
+             "address: 07 00 00 00\n"
+             "command: 02 00 00 00\n");
+  TEST_ASSERT_TRUE(inLibrary("Samsung", 0x0707, 0x02));
+
+  ImportResult result = importFile("tv.conf",
+                                   "begin remote\n"
+                                   "  bits 32\n"
+                                   "  header 4500 4500\n"
+                                   "  begin codes\n"
+                                   "    Power 0xE0E040BF\n"
+                                   "  end codes\n"
+                                   "end remote\n");
+  TEST_ASSERT_EQUAL_UINT32(1, result.duplicates);
+  TEST_ASSERT_EQUAL_UINT32(0, result.imported);
+}
+
+// LIRC allows 32 data bits; shifting pre_data by 32 must not be undefined behaviour
+void test_lirc_32_bit_codes() {
+  ImportResult result = importFile("lg.conf",
+                                   "begin remote\n"
+                                   "  bits 32\n"
+                                   "  header 9000 4500\n"
+                                   "  pre_data_bits 0\n"
+                                   "  pre_data 0xFFFF\n"
+                                   "  begin codes\n"
+                                   "    Power 0x20DF10EF\n"
+                                   "  end codes\n"
+                                   "end remote\n");
+  TEST_ASSERT_EQUAL_UINT32(1, result.imported);
+  TEST_ASSERT_TRUE(inLibrary("NEC", 0x04, 0x08));
+}
+
+// Many batches merged into the index keep it sorted and every code findable
+void test_index_merge_keeps_order() {
+  std::string csv;
+  for (int i = 0; i < 1000; i++) {
+    csv += "NEC," + std::to_string(i % 256) + "," + std::to_string(i / 256) + ",k" + std::to_string(i) + "\n";
+  }
+  size_t capacity = libraryIndex.capacity();
+  ImportResult result = importFile("many.csv", csv);
+  TEST_ASSERT_EQUAL_UINT32(1000, result.imported);
+  TEST_ASSERT_EQUAL_UINT32(1000, libraryIndex.size());
+  TEST_ASSERT_TRUE(indexSorted());
+  TEST_ASSERT_TRUE(libraryIndex.capacity() >= capacity);
+  String label;
+  TEST_ASSERT_TRUE(inLibrary("NEC", 999 % 256, 999 / 256, &label));
+  TEST_ASSERT_EQUAL_STRING("k999", label.c_str());
+}
+
+// With little heap the index is capped and the excess is rejected instead of allocated
+void test_index_capped_by_heap() {
+  libraryIndex.clear();
+  libraryIndex.shrink_to_fit();
+  mock::heapInfo = [](multi_heap_info_t* info) {
+    *info = { 60000, 100000, LIBRARY_HEAP_HEADROOM + 100 * sizeof(LibraryKey), 50000, 900, 20, 920 };
+  };
+  std::string csv;
+  for (int i = 0; i < 300; i++) {
+    csv += "RC5," + std::to_string(i % 32) + "," + std::to_string(i / 32) + "\n";
+  }
+  ImportResult result = importFile("rc5.csv", csv);
+  mock::heapInfo = nullptr;
+  TEST_ASSERT_EQUAL_UINT32(100, libraryIndex.capacity());
+  TEST_ASSERT_LESS_OR_EQUAL(100, result.imported);
+  TEST_ASSERT_EQUAL_UINT32(300 - result.imported, result.rejected);
+  TEST_ASSERT_TRUE(indexSorted());
+}
+
+// Import rate of a large library: each code written and merged on its own, as a per-entry
+// import would, against the batched path. Host CPU time, plus flash writes from the mock.
+struct RateResult {
+  double microsPerEntry;
+  uint32_t flashWrites;
+};
+
+static RateResult importDirect(uint32_t entries, bool perEntry) {
+  server.dispatch("/library_clear", HTTP_GET);
+  importState = ImportState();
+  reserveLibraryIndex(entries);
+  uint32_t writesBefore = mock::flashWrites;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < entries; i++) {
+    importCode("NEC", i % 256, i / 256, "key");
+    if (perEntry) {
+      flushImportBatch();
+    }
+  }
+  flushImportBatch();
+  double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_EQUAL_UINT32(entries, importState.imported);
+  TEST_ASSERT_TRUE(indexSorted());
+  return { micros / entries, mock::flashWrites - writesBefore };
+}
+
+void test_large_import_rate() {
+  const uint32_t entries = 6000;
+  RateResult perEntry = importDirect(entries, true);
+  RateResult batched = importDirect(entries, false);
+  TEST_ASSERT_EQUAL_UINT32(entries, perEntry.flashWrites);
+  TEST_ASSERT_EQUAL_UINT32((entries + IMPORT_BATCH_SIZE - 1) / IMPORT_BATCH_SIZE, batched.flashWrites);
+  TEST_ASSERT_TRUE(batched.microsPerEntry < perEntry.microsPerEntry);
+
+  // The whole upload path, parsing included
+  server.dispatch("/library_clear", HTTP_GET);
+  std::string csv;
+  for (uint32_t i = 0; i < entries; i++) {
+    csv += "NEC," + std::to_string(i % 256) + "," + std::to_string(i / 256) + ",key" + std::to_string(i) + "\n";
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  ImportResult result = importFile("large.csv", csv);
+  double uploadMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_EQUAL_UINT32(entries, result.imported);
+
+  char message[200];
+  snprintf(message, sizeof(message), "%u entries, host CPU: per-entry %.2f us/entry (%u flash writes), "
+           "batched %.2f us/entry (%u flash writes), CSV upload %.0f entries/s",
+           (unsigned)entries, perEntry.microsPerEntry, (unsigned)perEntry.flashWrites, batched.microsPerEntry,
+           (unsigned)batched.flashWrites, entries / (uploadMicros / 1e6));
+  TEST_MESSAGE(message);
+}
+
+// The capture path only looks at saved labels; the library label is added on the MQTT task
+void test_library_label_resolved_by_publisher() {
+  importFile("codes.csv", "NEC,0x4,0x8,Volume up\n");
+  mqttConfigured = true;
+  mock::receiveFrame({ NEC, 0x04, 0x08, 0 });
+  loop();
+
+  IREvent queued;
+  TEST_ASSERT_EQUAL(pdTRUE, xQueueReceive(mqttQueue, &queued, 0));
+  TEST_ASSERT_EQUAL_STRING("", queued.label);
+  pushMqttPending(queued);
+  IREvent pending;
+  TEST_ASSERT_EQUAL(1, peekMqttPending(&pending, 1));
+  TEST_ASSERT_EQUAL_STRING("Volume up", pending.label);
+  consumeMqttPending(1);
+  mqttConfigured = false;
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_csv_numbers_are_validated);
+  RUN_TEST(test_jsonl_numbers_are_validated);
+  RUN_TEST(test_samsung_address_expanded_like_lirc);
+  RUN_TEST(test_lirc_32_bit_codes);
+  RUN_TEST(test_index_merge_keeps_order);
+  RUN_TEST(test_index_capped_by_heap);
+  RUN_TEST(test_large_import_rate);
+  RUN_TEST(test_library_label_resolved_by_publisher);
+  return UNITY_END();
+}
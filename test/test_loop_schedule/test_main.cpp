@@ -0,0 +1,171 @@
+// Main loop schedule test: loopWaitBudget() deadlines and the resulting wakeup rates on the
+// simulated clock, edge-to-decode handling and the leader-mark loss check. Built with
+// IDLE_LIGHT_SLEEP (pio test -e native_lowpower) it also checks the automatic light sleep
+// setup and its gate on short-leader decoders.
+#include "main.cpp"
+
+#include <unity.h>
+
+// Web UI polling delivered from the loop's blocking waits
+uint64_t nextPollMs = 0;
+uint32_t pollIntervalMs = 0;
+
+static void pollingIdle(TickType_t ticks) {
+  uint64_t until = mock::nowMicros + (uint64_t)ticks * 1000;
+  if (pollIntervalMs > 0 && nextPollMs * 1000 <= until) {
+    mock::nowMicros = std::max<uint64_t>(mock::nowMicros, nextPollMs * 1000);
+    mock::queueRequest("/data");
+    nextPollMs += pollIntervalMs;
+    return;
+  }
+  mock::nowMicros = until;
+}
+
+static uint32_t wakeupsOver(uint32_t durationMs) {
+  uint32_t before = loopWakeups;
+  uint64_t end = millis() + durationMs;
+  while (millis() < end) {
+    loop();
+  }
+  return loopWakeups - before;
+}
+
+void setUp() {
+  static bool booted = false;
+  if (!booted) {
+    booted = true;
+    mock::wifiAvailable = true;
+    mock::nvs["wifi"] = { { "configured", "1" }, { "ssid", "home" }, { "password", "secret" } };
+    setup();
+    mock::idle = pollingIdle;
+  }
+  pollIntervalMs = 0;
+  mock::leaderLostTicks = 0;
+}
+
+void tearDown() {}
+
+// Each deadline on its own and in combination
+void test_budget_deadlines() {
+  TEST_ASSERT_EQUAL_UINT32(HTTP_IDLE_POLL_MS, loopWaitBudget(100000, 0, false, false, 0));
+  TEST_ASSERT_EQUAL_UINT32(HTTP_ACTIVE_POLL_MS, loopWaitBudget(100000, 99000, false, false, 0));
+  TEST_ASSERT_EQUAL_UINT32(HTTP_IDLE_POLL_MS, loopWaitBudget(100000, 100000 - HTTP_ACTIVE_WINDOW_MS, false, false, 0));
+  TEST_ASSERT_EQUAL_UINT32(FRAME_POLL_MS, loopWaitBudget(100000, 0, true, false, 0));
+  TEST_ASSERT_EQUAL_UINT32(30, loopWaitBudget(100000, 0, false, true, 100030));
+  TEST_ASSERT_EQUAL_UINT32(FRAME_POLL_MS, loopWaitBudget(100000, 0, true, true, 100030));
+  TEST_ASSERT_EQUAL_UINT32(0, loopWaitBudget(100000, 0, false, true, 99990));
+  TEST_ASSERT_EQUAL_UINT32(HTTP_ACTIVE_POLL_MS, loopWaitBudget(100000, 99000, false, true, 100030));
+}
+
+// Idle: one wakeup per HTTP idle poll; an open web page switches to the fast poll
+void test_wakeup_rates() {
+  wakeupsOver(HTTP_ACTIVE_WINDOW_MS + 100);
+  uint32_t idle = wakeupsOver(60000);
+  TEST_ASSERT_UINT32_WITHIN(2, 60000 / HTTP_IDLE_POLL_MS, idle);
+
+  pollIntervalMs = 500;
+  nextPollMs = millis() + 100;
+  uint32_t active = wakeupsOver(10000);
+  TEST_ASSERT_UINT32_WITHIN(20, 10000 / HTTP_ACTIVE_POLL_MS, active);
+
+  char message[96];
+  snprintf(message, sizeof(message), "wakeups/s: idle %.1f, web page open %.1f", idle / 60.0, active / 10.0);
+  TEST_MESSAGE(message);
+}
+
+// A frame's edge ends the wait at once and the edge is accounted on decode
+void test_edge_wakes_and_decodes() {
+  wakeupsOver(HTTP_ACTIVE_WINDOW_MS + 100);
+  uint32_t frames = signalCount;
+  uint32_t irBefore = irWakeups;
+  mock::receiveFrame({ NEC, 0x04, 0x08, 0 });
+  unsigned long start = millis();
+  loop();
+  TEST_ASSERT_EQUAL_UINT32(frames + 1, signalCount);
+  TEST_ASSERT_EQUAL_UINT32(irBefore + 1, irWakeups);
+  TEST_ASSERT_EQUAL_UINT32(start, millis());
+  TEST_ASSERT_FALSE(irEdgePending);
+
+  // An edge that never becomes a frame is dropped after the frame timeout
+  uint32_t noise = edgesWithoutFrame;
+  onIrEdge();
+  wakeupsOver(FRAME_TIMEOUT_MS + 2 * FRAME_POLL_MS);
+  TEST_ASSERT_EQUAL_UINT32(noise + 1, edgesWithoutFrame);
+  TEST_ASSERT_FALSE(irEdgePending);
+}
+
+// The leader-mark check sees the start of a frame lost to a slow wakeup
+void test_leader_loss_measured() {
+  leaderLossMicros = {};
+  maxLeaderLossMicros = 0;
+  mock::receiveFrame({ NEC, 0x04, 0x08, 0 });
+  loop();
+  TEST_ASSERT_EQUAL_UINT32(0, maxLeaderLossMicros);
+
+  mock::leaderLostTicks = 1000 / MICROS_PER_TICK;
+  mock::advanceMillis(500);
+  mock::receiveFrame({ NEC, 0x04, 0x08, 0 });
+  loop();
+  TEST_ASSERT_EQUAL_UINT32(1000, maxLeaderLossMicros);
+  TEST_ASSERT_EQUAL_UINT32(2, leaderLossMicros.count);
+
+  server.dispatch("/power", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"maxLeaderLossMicros\":1000") != std::string::npos);
+}
+
+#if defined(IDLE_LIGHT_SLEEP)
+static void postEnabled(const char* list) {
+  mock::requestArgs = { { "enabled", list } };
+  mock::requestMethod = HTTP_POST;
+  server.dispatch("/decoders", HTTP_POST);
+  mock::requestArgs.clear();
+  mock::requestMethod = HTTP_GET;
+}
+
+// Station mode: automatic light sleep with modem sleep, woken by the receiver pin
+void test_light_sleep_configured() {
+  TEST_ASSERT_TRUE(mock::pmConfigured);
+  TEST_ASSERT_TRUE(mock::pmConfig.light_sleep_enable);
+  TEST_ASSERT_TRUE(mock::modemSleep);
+  TEST_ASSERT_TRUE(mock::gpioWakeup[IR_RECEIVE_PIN]);
+}
+
+// Short-leader decoders block light sleep; a frame in capture keeps the chip awake
+void test_light_sleep_gate() {
+  postEnabled("");
+  TEST_ASSERT_TRUE(shortLeaderDecoderEnabled());
+  TEST_ASSERT_EQUAL(1, mock::noLightSleepLocks);
+  server.dispatch("/power", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"lightSleep\":\"blocked\"") != std::string::npos);
+
+  postEnabled("NEC,Samsung");
+  TEST_ASSERT_EQUAL(0, mock::noLightSleepLocks);
+  server.dispatch("/power", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"lightSleep\":\"on\"") != std::string::npos);
+
+  mock::advanceMillis(500);
+  mock::receiveFrame({ SAMSUNG, 0x0707, 0x02, 0 });
+  TEST_ASSERT_EQUAL(1, mock::noLightSleepLocks);
+  TEST_ASSERT_TRUE(mock::gpioIntrDisabled[IR_RECEIVE_PIN]);
+  loop();
+  TEST_ASSERT_EQUAL(0, mock::noLightSleepLocks);
+  TEST_ASSERT_FALSE(mock::gpioIntrDisabled[IR_RECEIVE_PIN]);
+
+  postEnabled("NEC,Sony");
+  TEST_ASSERT_EQUAL(1, mock::noLightSleepLocks);
+  postEnabled("");
+}
+#endif
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_budget_deadlines);
+  RUN_TEST(test_wakeup_rates);
+  RUN_TEST(test_edge_wakes_and_decodes);
+  RUN_TEST(test_leader_loss_measured);
+#if defined(IDLE_LIGHT_SLEEP)
+  RUN_TEST(test_light_sleep_configured);
+  RUN_TEST(test_light_sleep_gate);
+#endif
+  return UNITY_END();
+}
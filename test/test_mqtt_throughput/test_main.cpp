@@ -0,0 +1,234 @@
+// MQTT throughput test: sustained and burst IR event rates through the capture path and the
+// publisher, against the mock broker (2 ms per publish, about what a LAN mosquitto takes
+// for a QoS 0 message). The capture loop runs at each frame's arrival time while the
+// publisher waits, as the two cores do on the device.
+#include "main.cpp"
+
+#include <unity.h>
+
+// Remote presses scheduled for the capture side, in arrival order
+std::vector<uint64_t> frameTimes;
+size_t nextFrame = 0;
+uint32_t framesCaptured = 0;
+size_t peakQueueDepth = 0;
+
+static void captureDueFrames(uint64_t untilMicros, size_t maxFrames = SIZE_MAX) {
+  for (size_t captured = 0; captured < maxFrames && nextFrame < frameTimes.size() &&
+                            frameTimes[nextFrame] <= untilMicros; captured++) {
+    if (frameTimes[nextFrame] > mock::nowMicros) {
+      mock::nowMicros = frameTimes[nextFrame];
+    }
+    mock::receiveFrame({ NEC, 0x04, (uint16_t)(nextFrame & 0xFF), 0 });
+    nextFrame++;
+    loop();
+    framesCaptured++;
+    peakQueueDepth = std::max(peakQueueDepth, (size_t)uxQueueMessagesWaiting(mqttQueue));
+  }
+}
+
+// The publisher's blocking waits are where core 1 gets to capture frames. A queued event
+// ends the wait, so at most one frame is captured per wait.
+static void publisherIdle(TickType_t ticks) {
+  uint64_t until = mock::nowMicros + (uint64_t)ticks * 1000;
+  size_t before = nextFrame;
+  captureDueFrames(until, 1);
+  if (nextFrame == before) {
+    mock::nowMicros = until;
+  }
+}
+
+static void scheduleFrames(uint64_t startMs, uint32_t count, uint32_t intervalMs) {
+  mock::HostScope host;
+  frameTimes.clear();
+  nextFrame = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    frameTimes.push_back((startMs + i * intervalMs) * 1000);
+  }
+}
+
+// Run the publisher until every scheduled frame is captured and the backlog is gone
+static void runPublisher(uint64_t timeoutMs) {
+  uint64_t end = millis() + timeoutMs;
+  while (millis() < end) {
+    captureDueFrames(mock::nowMicros);
+    serviceMqtt();
+    if (nextFrame == frameTimes.size() && mqttPendingCount == 0 && mqttSpoolSize == 0 &&
+        uxQueueMessagesWaiting(mqttQueue) == 0) {
+      return;
+    }
+  }
+}
+
+static uint32_t eventsPublished() {
+  uint32_t events = 0;
+  for (size_t i = 0; i < mock::published.size(); i++) {
+    const std::string& payload = mock::published[i].payload;
+    for (size_t pos = payload.find("\"seq\":"); pos != std::string::npos; pos = payload.find("\"seq\":", pos + 1)) {
+      events++;
+    }
+  }
+  return events;
+}
+
+// Longest time from capture to publish, from the event timestamps in the payloads
+static unsigned long maxLatencyMs() {
+  unsigned long worst = 0;
+  for (size_t i = 0; i < mock::published.size(); i++) {
+    const std::string& payload = mock::published[i].payload;
+    unsigned long publishedMs = mock::published[i].atMicros / 1000;
+    for (size_t pos = payload.find("\"time\":"); pos != std::string::npos; pos = payload.find("\"time\":", pos + 1)) {
+      worst = std::max(worst, publishedMs - strtoul(payload.c_str() + pos + 7, nullptr, 10));
+    }
+  }
+  return worst;
+}
+
+static void resetCounters() {
+  mock::HostScope host;
+  mock::published.clear();
+  mqttPublished = mqttBatches = mqttDropped = mqttSpooled = 0;
+  framesCaptured = 0;
+  peakQueueDepth = 0;
+}
+
+void setUp() {
+  static bool booted = false;
+  if (!booted) {
+    booted = true;
+    mock::wifiAvailable = true;
+    mock::brokerUp = true;
+    mock::nvs["wifi"] = { { "configured", "1" }, { "ssid", "home" }, { "password", "secret" } };
+    mock::nvs["mqtt"] = { { "host", "192.168.1.10" }, { "port", "1883" }, { "topic", "esp32ir" } };
+    setup();
+    applyMqttConfig();
+    mqttClient.setBufferSize(sizeof(mqttPayload) + sizeof(mqttEventsTopic) + 16);
+    mock::idle = publisherIdle;
+  }
+  resetCounters();
+}
+
+void tearDown() {}
+
+// A held key repeats about every 110 ms; 20 events a second leaves plenty of headroom
+void test_sustained_rate_publishes_everything() {
+  const uint32_t frames = 20 * 60;
+  scheduleFrames(millis() + 10, frames, 50);
+  runPublisher(70000);
+  TEST_ASSERT_EQUAL_UINT32(frames, framesCaptured);
+  TEST_ASSERT_EQUAL_UINT32(0, mqttDropped);
+  TEST_ASSERT_EQUAL_UINT32(frames, mqttPublished);
+  TEST_ASSERT_EQUAL_UINT32(frames, eventsPublished());
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_QUEUE_LENGTH / 4, peakQueueDepth);
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_BATCH_LINGER_MS + 10, maxLatencyMs());
+
+  char message[128];
+  snprintf(message, sizeof(message), "20 events/s: %lu publishes, %.1f events per batch, peak queue %u, max latency %lu ms",
+           (unsigned long)mqttBatches, (double)mqttPublished / mqttBatches, (unsigned)peakQueueDepth, maxLatencyMs());
+  TEST_MESSAGE(message);
+}
+
+// Bursts far above any remote (one event per millisecond) are batched instead of dropped
+void test_burst_is_batched() {
+  const uint32_t frames = 500;
+  scheduleFrames(millis() + 10, frames, 1);
+  runPublisher(10000);
+  TEST_ASSERT_EQUAL_UINT32(0, mqttDropped);
+  TEST_ASSERT_EQUAL_UINT32(frames, eventsPublished());
+  TEST_ASSERT_LESS_OR_EQUAL(frames / 8, mqttBatches);
+  TEST_ASSERT_LESS_OR_EQUAL(MQTT_QUEUE_LENGTH, peakQueueDepth);
+
+  char message[96];
+  snprintf(message, sizeof(message), "1000 events/s burst: %lu publishes, peak queue %u",
+           (unsigned long)mqttBatches, (unsigned)peakQueueDepth);
+  TEST_MESSAGE(message);
+}
+
+// A broker outage fills the RAM buffer, spills to the flash spool and drains in order
+void test_outage_spools_and_drains_in_order() {
+  const uint32_t frames = 10 * 60;
+  mock::brokerUp = false;
+  mqttClient.disconnect();
+  scheduleFrames(millis() + 10, frames, 100);
+  runPublisher(frames * 100 + 100);
+  TEST_ASSERT_GREATER_THAN(0, mqttSpooled);
+  TEST_ASSERT_EQUAL_UINT32(0, mock::published.size());
+
+  mock::brokerUp = true;
+  runPublisher(MQTT_RECONNECT_MS + 30000);
+  TEST_ASSERT_EQUAL_UINT32(0, mqttDropped);
+  TEST_ASSERT_EQUAL_UINT32(frames, eventsPublished());
+  TEST_ASSERT_EQUAL_UINT32(0, mqttSpoolSize);
+
+  // Sequence numbers come out in capture order across the spool and the RAM buffer
+  unsigned long previous = 0;
+  bool ordered = true;
+  for (size_t i = 0; i < mock::published.size(); i++) {
+    const std::string& payload = mock::published[i].payload;
+    for (size_t pos = payload.find("\"seq\":"); pos != std::string::npos; pos = payload.find("\"seq\":", pos + 1)) {
+      unsigned long seq = strtoul(payload.c_str() + pos + 6, nullptr, 10);
+      ordered = ordered && seq > previous;
+      previous = seq;
+    }
+  }
+  TEST_ASSERT_TRUE(ordered);
+}
+
+// A reboot mid-drain resumes from the saved read position instead of resending the spool
+void test_reboot_resumes_spool() {
+  const uint32_t frames = 10 * 60;
+  mock::brokerUp = false;
+  mqttClient.disconnect();
+  scheduleFrames(millis() + 10, frames, 100);
+  runPublisher(frames * 100 + 100);
+  TEST_ASSERT_GREATER_THAN(2 * MQTT_MAX_BATCH * sizeof(IREvent), mqttSpoolSize);
+
+  // Two batches went out before the reset
+  IREvent batch[MQTT_MAX_BATCH];
+  uint32_t lastSent = 0;
+  for (int i = 0; i < 2; i++) {
+    int count = readMqttSpool(batch, MQTT_MAX_BATCH);
+    lastSent = batch[count - 1].sequence;
+    consumeMqttSpool(count);
+  }
+  size_t readPos = mqttSpoolReadPos;
+  loadMqttSpool();
+  TEST_ASSERT_EQUAL_UINT32(readPos, mqttSpoolReadPos);
+
+  mock::brokerUp = true;
+  runPublisher(MQTT_RECONNECT_MS + 30000);
+  TEST_ASSERT_EQUAL_UINT32(0, mqttSpoolSize);
+  unsigned long firstSeq = 0;
+  for (size_t i = 0; i < mock::published.size() && firstSeq == 0; i++) {
+    size_t pos = mock::published[i].payload.find("\"seq\":");
+    if (pos != std::string::npos) {
+      firstSeq = strtoul(mock::published[i].payload.c_str() + pos + 6, nullptr, 10);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(lastSent + 1, firstSeq);
+  TEST_ASSERT_EQUAL_UINT32(frames - 2 * MQTT_MAX_BATCH, eventsPublished());
+  TEST_ASSERT_EQUAL(0, mock::nvs["mqttspool"].count("pos"));
+}
+
+// Host, user and topic are user input and must not break the status JSON
+void test_status_escapes_config() {
+  mock::requestArgs = { { "host", "broker\"x" }, { "topic", "home\\ir" }, { "user", "a\"b" }, { "port", "1883" } };
+  mock::requestMethod = HTTP_POST;
+  server.dispatch("/mqtt_config", HTTP_POST);
+  mock::requestArgs.clear();
+  mock::requestMethod = HTTP_GET;
+  server.dispatch("/mqtt_status", HTTP_GET);
+  const std::string& body = mock::response.body;
+  TEST_ASSERT_TRUE(body.find("\"host\":\"broker\\\"x\"") != std::string::npos);
+  TEST_ASSERT_TRUE(body.find("\"topic\":\"home\\\\ir\"") != std::string::npos);
+  TEST_ASSERT_TRUE(body.find("\"user\":\"a\\\"b\"") != std::string::npos);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_sustained_rate_publishes_everything);
+  RUN_TEST(test_burst_is_batched);
+  RUN_TEST(test_outage_spools_and_drains_in_order);
+  RUN_TEST(test_reboot_resumes_spool);
+  RUN_TEST(test_status_escapes_config);
+  return UNITY_END();
+}
@@ -0,0 +1,170 @@
+// RTC history test: events and saved commands kept in RTC memory across a warm reset, the
+// per-slot checksums that validate them (a torn slot truncates the ring) and what /data shows
+// for a restored signal.
+#include "main.cpp"
+
+#include <unity.h>
+
+// Firmware state lost on a reset; rtcHistory (RTC_NOINIT_ATTR) is left as it was
+static void warmReset(esp_reset_reason_t reason) {
+  mock::resetReason = reason;
+  savedCommands.clear();
+  protocolIndex.clear();
+  addressIndex.clear();
+  nextCommandId = 1;
+  signalCount = 0;
+  lastReceiveTime = 0;
+  historyRestored = false;
+  lastEvent = {};
+  wallClockValid = false;
+  restoreRtcHistory();
+}
+
+static void press(uint16_t command) {
+  mock::advanceMillis(500);
+  mock::receiveFrame({ NEC, 0x04, command, 0 });
+  loop();
+}
+
+static void saveLast(const char* label) {
+  mock::requestArgs = { { "label", label } };
+  server.dispatch("/save", HTTP_GET);
+  mock::requestArgs.clear();
+}
+
+void setUp() {
+  static bool booted = false;
+  if (!booted) {
+    booted = true;
+    setup();
+  }
+}
+
+void tearDown() {}
+
+void test_warm_reset_restores_history() {
+  press(0x01);
+  saveLast("Power");
+  for (uint16_t i = 0; i < RTC_HISTORY_EVENTS + 8; i++) {
+    press(0x10 + i);
+  }
+  saveLast("Last");
+  uint32_t signals = signalCount;
+  uint16_t lastCommand = lastEvent.command;
+
+  warmReset(ESP_RST_PANIC);
+  TEST_ASSERT_TRUE(historyRestored);
+  TEST_ASSERT_EQUAL_UINT32(signals, signalCount);
+  TEST_ASSERT_EQUAL_UINT16(lastCommand, lastEvent.command);
+  TEST_ASSERT_EQUAL_UINT32(2, savedCommands.size());
+  TEST_ASSERT_EQUAL_STRING("Last", savedCommands[1].label.c_str());
+
+  // The restored code is shown with when it was received, not next to "No signal yet"
+  server.dispatch("/data", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"lastTime\":\"Before the last reset\"") != std::string::npos);
+  press(0x02);
+  server.dispatch("/data", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"lastTime\":\"0 seconds ago\"") != std::string::npos);
+}
+
+// A frame stamped with Unix time is aged once NTP has synced again after the reset
+void test_restored_signal_age() {
+  mock::ntpConfigured = true;
+  mock::ntpReachable = true;
+  checkWallClock();
+  TEST_ASSERT_TRUE(wallClockValid);
+  press(0x07);
+
+  warmReset(ESP_RST_PANIC);
+  mock::advanceMillis(90000);
+  server.dispatch("/data", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"lastTime\":\"Before the last reset\"") != std::string::npos);
+  checkWallClock();
+  server.dispatch("/data", HTTP_GET);
+  uint32_t age = time(NULL) - lastEvent.time;
+  TEST_ASSERT_UINT32_WITHIN(1, 90, age);
+  std::string expected = "\"lastTime\":\"" + std::to_string(age) + " seconds ago\"";
+  TEST_ASSERT_TRUE(mock::response.body.find(expected) != std::string::npos);
+  mock::ntpConfigured = false;
+  mock::ntpReachable = false;
+}
+
+// A frame seals the counters and its own slot; a torn slot that is not on flash yet truncates
+// the ring there and keeps everything else
+void test_torn_event_slot_truncates() {
+  flushHistory();
+  press(0x03);
+  press(0x04);
+  press(0x05);
+  saveLast("Mute");
+  warmReset(ESP_RST_SW);
+  TEST_ASSERT_TRUE(historyRestored);
+  uint32_t signals = signalCount;
+  size_t saved = savedCommands.size();
+  uint32_t nextSeq = rtcHistory.nextSeq;
+  uint32_t dropped = historyDropped;
+
+  rtcHistory.events[(nextSeq - 2) % RTC_HISTORY_EVENTS].command ^= 0x40;
+  warmReset(ESP_RST_SW);
+  TEST_ASSERT_TRUE(historyRestored);
+  TEST_ASSERT_EQUAL_UINT32(nextSeq - 2, rtcHistory.nextSeq);
+  TEST_ASSERT_EQUAL_UINT32(dropped + 2, historyDropped);
+  TEST_ASSERT_EQUAL_UINT16(0x03, lastEvent.command);
+  TEST_ASSERT_EQUAL_UINT32(signals, signalCount);
+  TEST_ASSERT_EQUAL_UINT32(saved, savedCommands.size());
+
+  // Sealed again, so the next reset restores without dropping more
+  warmReset(ESP_RST_SW);
+  TEST_ASSERT_EQUAL_UINT32(nextSeq - 2, rtcHistory.nextSeq);
+
+  // The slots of the dropped events are not listed as older ones
+  mock::requestArgs = { { "limit", "100" } };
+  server.dispatch("/history", HTTP_GET);
+  mock::requestArgs.clear();
+  std::string newest = "\"events\":[{\"seq\":" + std::to_string(nextSeq - 3) + ",";
+  TEST_ASSERT_TRUE(mock::response.body.find(newest) != std::string::npos);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"seq\":" + std::to_string(nextSeq - 1) + ",") == std::string::npos);
+}
+
+// A bad slot that is already on flash means RTC memory itself is not trustworthy
+void test_corrupt_flushed_slot_starts_fresh() {
+  press(0x06);
+  flushHistory();
+  rtcHistory.events[(rtcHistory.nextSeq - 1) % RTC_HISTORY_EVENTS].command ^= 0x40;
+  warmReset(ESP_RST_SW);
+  TEST_ASSERT_FALSE(historyRestored);
+  TEST_ASSERT_EQUAL_UINT32(0, signalCount);
+  TEST_ASSERT_EQUAL_UINT32(0, savedCommands.size());
+}
+
+void test_corrupt_command_starts_fresh() {
+  press(0x04);
+  saveLast("Volume");
+  warmReset(ESP_RST_TASK_WDT);
+  TEST_ASSERT_EQUAL_UINT32(1, savedCommands.size());
+
+  rtcHistory.commands[0].label[0] = 'X';
+  warmReset(ESP_RST_TASK_WDT);
+  TEST_ASSERT_FALSE(historyRestored);
+  TEST_ASSERT_EQUAL_UINT32(0, savedCommands.size());
+}
+
+// Power loss never trusts RTC memory, even when it happens to look valid
+void test_power_on_starts_fresh() {
+  press(0x05);
+  warmReset(ESP_RST_POWERON);
+  TEST_ASSERT_FALSE(historyRestored);
+  server.dispatch("/data", HTTP_GET);
+  TEST_ASSERT_TRUE(mock::response.body.find("\"lastTime\":\"No signal yet\"") != std::string::npos);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_warm_reset_restores_history);
+  RUN_TEST(test_restored_signal_age);
+  RUN_TEST(test_torn_event_slot_truncates);
+  RUN_TEST(test_corrupt_flushed_slot_starts_fresh);
+  RUN_TEST(test_corrupt_command_starts_fresh);
+  RUN_TEST(test_power_on_starts_fresh);
+  return UNITY_END();
+}
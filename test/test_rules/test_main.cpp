@@ -0,0 +1,47 @@
+// Rule compiler test: condition options and output pins that rules may not drive.
+#include "main.cpp"
+
+#include <unity.h>
+
+void setUp() {}
+void tearDown() {}
+
+void test_condition_options() {
+  TEST_ASSERT_EQUAL_STRING("", compileRules("NEC 0x4 0x8 hold=500 repeat=3 -> gpio 13").c_str());
+  TEST_ASSERT_EQUAL_UINT32(500, rules[0].holdMs);
+  TEST_ASSERT_EQUAL_UINT32(3, rules[0].repeatCount);
+  TEST_ASSERT_EQUAL_STRING("", compileRules("NEC 0x4 0x8 -> gpio 13").c_str());
+  TEST_ASSERT_EQUAL_UINT32(0, rules[0].holdMs);
+}
+
+void test_unknown_or_malformed_options_rejected() {
+  TEST_ASSERT_TRUE(compileRules("NEC 0x4 0x8 hodl=500 -> gpio 13").indexOf("unknown condition 'hodl=500'") >= 0);
+  TEST_ASSERT_TRUE(compileRules("NEC 0x4 0x8 hold -> gpio 13").indexOf("invalid condition") >= 0);
+  TEST_ASSERT_TRUE(compileRules("NEC 0x4 0x8 hold=5s -> gpio 13").indexOf("invalid condition") >= 0);
+  TEST_ASSERT_TRUE(compileRules("NEC 0x4 0x8 repeat=300 -> gpio 13").indexOf("invalid condition") >= 0);
+}
+
+void test_console_and_strap_pins_rejected() {
+  TEST_ASSERT_FALSE(isOutputPin(0));
+  TEST_ASSERT_FALSE(isOutputPin(1));
+  TEST_ASSERT_FALSE(isOutputPin(3));
+  TEST_ASSERT_FALSE(isOutputPin(6));
+  TEST_ASSERT_FALSE(isOutputPin(IR_RECEIVE_PIN));
+  TEST_ASSERT_FALSE(isOutputPin(IR_TRANSMIT_PIN));
+  TEST_ASSERT_FALSE(isOutputPin(LED_PIN));
+  TEST_ASSERT_FALSE(isOutputPin(5));
+  TEST_ASSERT_FALSE(isOutputPin(12));
+  TEST_ASSERT_FALSE(isOutputPin(15));
+  TEST_ASSERT_FALSE(isOutputPin(34));
+  TEST_ASSERT_TRUE(isOutputPin(13));
+  TEST_ASSERT_TRUE(isOutputPin(16));
+  TEST_ASSERT_TRUE(compileRules("NEC 0x4 0x8 -> gpio 1").indexOf("invalid output pin") >= 0);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_condition_options);
+  RUN_TEST(test_unknown_or_malformed_options_rejected);
+  RUN_TEST(test_console_and_strap_pins_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,94 @@
+// Time-series persistence test: counters recorded while wall-clock history waits for NTP
+// (access point mode) must survive reboots and be merged once NTP syncs, without loss or
+// double counting.
+#include "main.cpp"
+
+#include <unity.h>
+
+time_t wallClockNow = mock::wallClockAtBoot;
+
+// Power-cycle the clock and time-series state, then boot the time series as setup() does
+static void reboot(bool ntp) {
+  wallClockNow += mock::nowMicros / 1000000 + 60;
+  mock::wallClockAtBoot = wallClockNow;
+  mock::nowMicros = 0;
+  mock::ntpConfigured = false;
+  mock::ntpReachable = ntp;
+  uptimeMs = 0;
+  clockLastMillis = 0;
+  timelineOffset = 0;
+  wallClockValid = false;
+  wifiConnected = ntp;
+  beginTimeSeries();
+}
+
+static void press(int count) {
+  for (int i = 0; i < count; i++) {
+    mock::advanceMillis(2000);
+    recordTimeSeriesEvent(NEC, 0x04, 0x08);
+  }
+}
+
+// Run loop-side time-series work long enough for one periodic persist
+static void runPastPersist() {
+  for (unsigned long t = 0; t <= TIMESERIES_PERSIST_MS; t += 1000) {
+    mock::advanceMillis(1000);
+    serviceTimeSeries();
+  }
+}
+
+static uint32_t pressesToday() {
+  uint32_t total = 0;
+  for (int i = 0; i < TS_DAYS; i++) {
+    total += timeSeries[0].days[i];
+  }
+  return total;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_access_point_boots_keep_counting() {
+  flashMounted = LittleFS.begin(true);
+
+  // Station mode: NTP syncs, counters are persisted on the wall-clock timeline
+  reboot(true);
+  serviceTimeSeries();
+  TEST_ASSERT_TRUE(wallClockValid);
+  press(5);
+  persistTimeSeries();
+  TEST_ASSERT_FALSE(LittleFS.exists(TIMESERIES_LIVE_FILE));
+
+  // Access point mode: the wall-clock file waits, live counters go to the device-time file
+  reboot(false);
+  TEST_ASSERT_TRUE(timeSeriesRestorePending);
+  press(3);
+  runPastPersist();
+  TEST_ASSERT_TRUE(LittleFS.exists(TIMESERIES_LIVE_FILE));
+  TEST_ASSERT_EQUAL_UINT32(3, pressesToday());
+
+  // Another access point boot continues from the device-time file
+  reboot(false);
+  TEST_ASSERT_EQUAL_UINT32(3, pressesToday());
+  press(2);
+  runPastPersist();
+
+  // Back in station mode: both histories are merged once NTP syncs, then saved as one file
+  reboot(true);
+  TEST_ASSERT_EQUAL_UINT32(5, pressesToday());
+  serviceTimeSeries();
+  TEST_ASSERT_FALSE(timeSeriesRestorePending);
+  TEST_ASSERT_EQUAL_UINT32(10, pressesToday());
+  runPastPersist();
+  TEST_ASSERT_FALSE(LittleFS.exists(TIMESERIES_LIVE_FILE));
+
+  reboot(true);
+  serviceTimeSeries();
+  TEST_ASSERT_EQUAL_UINT32(10, pressesToday());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_access_point_boots_keep_counting);
+  return UNITY_END();
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Build each decoder profile and compare the size of the firmware image that gets flashed.
+# Run from the project root: tools/profile_sizes.sh
+set -e
+
+ENVS="esp32dev esp32dev_tv esp32dev_nec"
+for env in $ENVS; do
+  platformio run -s -e "$env"
+done
+
+full=$(wc -c < .pio/build/esp32dev/firmware.bin)
+printf '%-14s %10s %10s\n' "profile" "bytes" "saved"
+for env in $ENVS; do
+  size=$(wc -c < ".pio/build/$env/firmware.bin")
+  printf '%-14s %10d %10d\n' "$env" "$size" "$((full - size))"
+done